@@ -0,0 +1,84 @@
+package com.simplexray.an.common
+
+import android.app.AppOpsManager
+import android.app.usage.NetworkStats
+import android.app.usage.NetworkStatsManager
+import android.content.Context
+import android.net.ConnectivityManager
+import android.os.Process
+import android.os.SystemClock
+import android.util.Log
+import android.util.SparseLongArray
+
+/**
+ * Per-UID throughput sampled from the system's network accounting. Traffic routed through the
+ * VPN is attributed by the platform to the originating app on the underlying network, so summing
+ * the per-UID buckets for Wi-Fi and mobile gives each app's share of the tunnel without having to
+ * resolve connection owners ourselves.
+ */
+class AppTrafficMonitor(context: Context) {
+    private val context = context.applicationContext
+    private val networkStatsManager =
+        context.getSystemService(Context.NETWORK_STATS_SERVICE) as NetworkStatsManager
+    private val startTime = System.currentTimeMillis()
+
+    private var lastTotals = SparseLongArray()
+    private var lastSampleAt = 0L
+
+    fun hasUsageAccess(): Boolean {
+        val appOps = context.getSystemService(Context.APP_OPS_SERVICE) as AppOpsManager
+        val mode = appOps.unsafeCheckOpNoThrow(
+            AppOpsManager.OPSTR_GET_USAGE_STATS,
+            Process.myUid(),
+            context.packageName
+        )
+        return mode == AppOpsManager.MODE_ALLOWED
+    }
+
+    /**
+     * Returns bytes per second for every UID that moved data since the previous call. The first
+     * call only establishes the baseline and returns an empty result.
+     */
+    fun sampleRates(): SparseLongArray {
+        val totals = SparseLongArray()
+        val end = System.currentTimeMillis() + BUCKET_SLACK_MS
+        collectTotals(ConnectivityManager.TYPE_WIFI, end, totals)
+        collectTotals(ConnectivityManager.TYPE_MOBILE, end, totals)
+
+        val now = SystemClock.elapsedRealtime()
+        val rates = SparseLongArray()
+        if (lastSampleAt > 0) {
+            val elapsedMs = (now - lastSampleAt).coerceAtLeast(1)
+            for (i in 0 until totals.size()) {
+                val uid = totals.keyAt(i)
+                val delta = totals.valueAt(i) - lastTotals.get(uid, 0)
+                if (delta > 0) rates.put(uid, delta * 1000 / elapsedMs)
+            }
+        }
+        lastTotals = totals
+        lastSampleAt = now
+        return rates
+    }
+
+    private fun collectTotals(networkType: Int, end: Long, totals: SparseLongArray) {
+        try {
+            networkStatsManager.querySummary(networkType, null, startTime, end).use { stats ->
+                val bucket = NetworkStats.Bucket()
+                while (stats.hasNextBucket()) {
+                    stats.getNextBucket(bucket)
+                    val uid = bucket.uid
+                    totals.put(uid, totals.get(uid, 0) + bucket.rxBytes + bucket.txBytes)
+                }
+            }
+        } catch (e: SecurityException) {
+            Log.w(TAG, "Usage access not granted", e)
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to query network stats for type $networkType", e)
+        }
+    }
+
+    companion object {
+        private const val TAG = "AppTrafficMonitor"
+        private const val BUCKET_SLACK_MS = 60_000L
+    }
+}
@@ -0,0 +1,193 @@
+package com.simplexray.an.common
+
+import android.util.Log
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.async
+import kotlinx.coroutines.awaitAll
+import kotlinx.coroutines.coroutineScope
+import kotlinx.coroutines.delay
+import kotlinx.coroutines.ensureActive
+import kotlinx.coroutines.sync.Semaphore
+import kotlinx.coroutines.sync.withPermit
+import org.json.JSONException
+import java.io.File
+import java.io.IOException
+import java.net.InetAddress
+import java.net.InetSocketAddress
+import java.net.Proxy
+import java.net.ServerSocket
+import java.net.Socket
+import java.net.URL
+import javax.net.ssl.SSLSocket
+import javax.net.ssl.SSLSocketFactory
+import kotlin.coroutines.coroutineContext
+
+/**
+ * Best of [SAMPLES] requests through one config. Xray's SOCKS inbound acknowledges CONNECT
+ * before it dials the outbound, so [tcpMs] is mostly local and the remote dial is part of
+ * [tlsMs] (or of [firstByteMs] for plain http targets).
+ */
+data class ConfigLatency(
+    val tcpMs: Long,
+    val tlsMs: Long?,
+    val firstByteMs: Long
+) {
+    val totalMs: Long get() = tcpMs + (tlsMs ?: 0) + firstByteMs
+}
+
+/**
+ * Ranks many configs at once. Each config gets its own short-lived core on a free loopback port,
+ * running the [ConfigProcessor.probe] variant of the config, and that one core serves every
+ * sample for it. At most [PARALLELISM] cores run at a time. The app is excluded from its own VPN,
+ * so probes reach the servers directly whether or not the service is running.
+ */
+class ConfigLatencyTester(
+    private val xrayPath: String,
+    private val workingDir: File,
+    private val targetUrl: URL,
+    private val timeoutMs: Int
+) {
+    private val sslSocketFactory = SSLSocketFactory.getDefault() as SSLSocketFactory
+
+    suspend fun testAll(
+        files: List<File>,
+        onResult: (File, ConfigLatency?) -> Unit
+    ) = coroutineScope {
+        val permits = Semaphore(PARALLELISM)
+        files.map { file ->
+            async(Dispatchers.IO) {
+                permits.withPermit { onResult(file, test(file)) }
+            }
+        }.awaitAll()
+    }
+
+    private suspend fun test(file: File): ConfigLatency? {
+        val port = allocatePort() ?: return null
+        val config = try {
+            ConfigProcessor.probe(file.readText(), port)
+        } catch (e: IOException) {
+            Log.w(TAG, "Cannot read ${file.name}", e)
+            return null
+        } catch (e: JSONException) {
+            Log.w(TAG, "Cannot parse ${file.name}", e)
+            return null
+        }
+        val process = try {
+            ProcessBuilder(xrayPath).apply {
+                environment()["XRAY_LOCATION_ASSET"] = workingDir.path
+                directory(workingDir)
+                redirectErrorStream(true)
+            }.start()
+        } catch (e: IOException) {
+            Log.w(TAG, "Failed to start core for ${file.name}", e)
+            return null
+        }
+        try {
+            process.outputStream.use { it.write(config.toByteArray()) }
+            drainOutput(process)
+            if (!awaitListening(process, port)) {
+                Log.w(TAG, "Core for ${file.name} did not come up")
+                return null
+            }
+            var best: ConfigLatency? = null
+            repeat(SAMPLES) {
+                coroutineContext.ensureActive()
+                val sample = probe(port) ?: return@repeat
+                val current = best
+                if (current == null || sample.totalMs < current.totalMs) best = sample
+            }
+            return best
+        } catch (e: IOException) {
+            Log.w(TAG, "Probe for ${file.name} failed", e)
+            return null
+        } finally {
+            process.destroy()
+        }
+    }
+
+    /** The core is started with logging off, but anything it prints must not fill the pipe. */
+    private fun drainOutput(process: Process) {
+        Thread {
+            try {
+                process.inputStream.use { input ->
+                    val buffer = ByteArray(4096)
+                    while (input.read(buffer) >= 0) Unit
+                }
+            } catch (ignored: IOException) {
+            }
+        }.apply { isDaemon = true }.start()
+    }
+
+    private suspend fun awaitListening(process: Process, port: Int): Boolean {
+        val deadline = System.nanoTime() + STARTUP_TIMEOUT_MS * 1_000_000
+        while (System.nanoTime() < deadline && process.isAlive) {
+            val listening = try {
+                Socket().use {
+                    it.connect(InetSocketAddress(InetAddress.getLoopbackAddress(), port), 100)
+                }
+                true
+            } catch (e: IOException) {
+                false
+            }
+            if (listening) return true
+            delay(STARTUP_POLL_MS)
+        }
+        return false
+    }
+
+    /** One request through the SOCKS inbound on [port]; the service also samples flows with it. */
+    fun probe(port: Int): ConfigLatency? {
+        val proxy = Proxy(
+            Proxy.Type.SOCKS,
+            InetSocketAddress(InetAddress.getLoopbackAddress(), port)
+        )
+        val host = targetUrl.host
+        val targetPort = if (targetUrl.port > 0) targetUrl.port else targetUrl.defaultPort
+        val path = if (targetUrl.path.isNullOrEmpty()) "/" else targetUrl.path
+        return try {
+            Socket(proxy).use { socket ->
+                socket.soTimeout = timeoutMs
+                val start = System.nanoTime()
+                socket.connect(InetSocketAddress.createUnresolved(host, targetPort), timeoutMs)
+                val connected = System.nanoTime()
+                val stream = if (targetUrl.protocol == "https") {
+                    (sslSocketFactory.createSocket(socket, host, targetPort, true) as SSLSocket)
+                        .also { it.startHandshake() }
+                } else {
+                    socket
+                }
+                val handshaken = System.nanoTime()
+                val output = stream.getOutputStream()
+                output.write(
+                    "HEAD $path HTTP/1.1\r\nHost: $host\r\nConnection: close\r\n\r\n".toByteArray()
+                )
+                output.flush()
+                if (stream.getInputStream().read() < 0) return null
+                val firstByte = System.nanoTime()
+                ConfigLatency(
+                    tcpMs = (connected - start) / NANOS_PER_MS,
+                    tlsMs = if (stream !== socket) (handshaken - connected) / NANOS_PER_MS else null,
+                    firstByteMs = (firstByte - handshaken) / NANOS_PER_MS
+                )
+            }
+        } catch (e: IOException) {
+            null
+        }
+    }
+
+    private fun allocatePort(): Int? = try {
+        ServerSocket(0, 1, InetAddress.getLoopbackAddress()).use { it.localPort }
+    } catch (e: IOException) {
+        Log.w(TAG, "Ephemeral port allocation failed", e)
+        null
+    }
+
+    companion object {
+        private const val TAG = "ConfigLatencyTester"
+        private const val PARALLELISM = 4
+        private const val SAMPLES = 3
+        private const val STARTUP_TIMEOUT_MS = 5000L
+        private const val STARTUP_POLL_MS = 50L
+        private const val NANOS_PER_MS = 1_000_000L
+    }
+}
@@ -0,0 +1,259 @@
+package com.simplexray.an.common
+
+import com.google.gson.Strictness
+import com.google.gson.stream.JsonReader
+import com.google.gson.stream.JsonToken
+import com.google.gson.stream.JsonWriter
+import org.json.JSONException
+import java.io.IOException
+import java.io.StringReader
+import java.io.StringWriter
+
+/**
+ * Single streaming pass over an Xray config that collects the ports it uses, optionally strips
+ * the `log.access`/`log.error` file paths and injects the `api`, `stats` and `policy` blocks,
+ * without ever building a tree of the document. Number literals are copied through verbatim.
+ * The reader is lenient, like org.json, so commented configs keep working.
+ *
+ * [probe] produces the throwaway variant the latency tester runs: inbounds replaced by one
+ * loopback SOCKS inbound, logging off and the API blocks dropped, outbounds and routing as-is.
+ */
+object ConfigProcessor {
+    class Result(val content: String, val ports: Set<Int>)
+
+    private val INJECTED_KEYS = listOf("api", "stats", "policy")
+    private val LOG_FILE_KEYS = setOf("access", "error")
+    private val PROBE_REPLACED_KEYS = listOf("inbounds", "log")
+    private val PROBE_DROPPED_KEYS = setOf("api", "stats", "policy")
+    private const val INDENT = "  "
+
+    /**
+     * @param apiPort inject the stats API listening on this port, or null to leave the blocks be.
+     * @param writeOutput false to only collect ports; [Result.content] is then empty.
+     */
+    @Throws(JSONException::class)
+    fun process(
+        content: String,
+        apiPort: Int? = null,
+        stripLogFiles: Boolean = false,
+        writeOutput: Boolean = true
+    ): Result {
+        val buffer = if (writeOutput) StringWriter(content.length + 256) else null
+        val ports = mutableSetOf<Int>()
+        try {
+            val reader = JsonReader(StringReader(content))
+            reader.setStrictness(Strictness.LENIENT)
+            val writer = buffer?.let { JsonWriter(it).apply { setIndent(INDENT) } }
+            Pass(reader, writer, ports).processRoot(apiPort, stripLogFiles)
+            writer?.flush()
+        } catch (e: IOException) {
+            throw JSONException(e.message ?: "Malformed config")
+        } catch (e: IllegalStateException) {
+            throw JSONException(e.message ?: "Malformed config")
+        }
+        return Result(buffer?.toString() ?: "", ports)
+    }
+
+    @Throws(JSONException::class)
+    fun probe(content: String, socksPort: Int): String {
+        val buffer = StringWriter(content.length + 256)
+        try {
+            val reader = JsonReader(StringReader(content))
+            reader.setStrictness(Strictness.LENIENT)
+            val writer = JsonWriter(buffer).apply { setIndent(INDENT) }
+            Pass(reader, writer, mutableSetOf()).processProbeRoot(socksPort)
+            writer.flush()
+        } catch (e: IOException) {
+            throw JSONException(e.message ?: "Malformed config")
+        } catch (e: IllegalStateException) {
+            throw JSONException(e.message ?: "Malformed config")
+        }
+        return buffer.toString()
+    }
+
+    private class Pass(
+        private val reader: JsonReader,
+        private val out: JsonWriter?,
+        private val ports: MutableSet<Int>
+    ) {
+        fun processRoot(apiPort: Int?, stripLogFiles: Boolean) {
+            if (reader.peek() != JsonToken.BEGIN_OBJECT) {
+                throw JSONException("Config must be a JSON object")
+            }
+            reader.beginObject()
+            out?.beginObject()
+            val injected = mutableSetOf<String>()
+            while (reader.hasNext()) {
+                val name = reader.nextName()
+                when {
+                    apiPort != null && name in INJECTED_KEYS -> {
+                        reader.skipValue()
+                        if (injected.add(name)) writeInjected(name, apiPort)
+                    }
+
+                    stripLogFiles && name == "log" && reader.peek() == JsonToken.BEGIN_OBJECT -> {
+                        out?.name(name)
+                        copyLog()
+                    }
+
+                    else -> {
+                        out?.name(name)
+                        copyValue(inObject = true)
+                    }
+                }
+            }
+            if (apiPort != null) {
+                INJECTED_KEYS.filter { it !in injected }.forEach { writeInjected(it, apiPort) }
+            }
+            reader.endObject()
+            out?.endObject()
+        }
+
+        fun processProbeRoot(socksPort: Int) {
+            if (reader.peek() != JsonToken.BEGIN_OBJECT) {
+                throw JSONException("Config must be a JSON object")
+            }
+            reader.beginObject()
+            out?.beginObject()
+            val replaced = mutableSetOf<String>()
+            while (reader.hasNext()) {
+                val name = reader.nextName()
+                when (name) {
+                    in PROBE_DROPPED_KEYS -> reader.skipValue()
+                    in PROBE_REPLACED_KEYS -> {
+                        reader.skipValue()
+                        if (replaced.add(name)) writeProbe(name, socksPort)
+                    }
+
+                    else -> {
+                        out?.name(name)
+                        copyValue(inObject = true)
+                    }
+                }
+            }
+            PROBE_REPLACED_KEYS.filter { it !in replaced }.forEach { writeProbe(it, socksPort) }
+            reader.endObject()
+            out?.endObject()
+        }
+
+        /** Drops file paths from the log block; `"none"` is kept since it disables logging. */
+        private fun copyLog() {
+            reader.beginObject()
+            out?.beginObject()
+            while (reader.hasNext()) {
+                val name = reader.nextName()
+                if (name !in LOG_FILE_KEYS) {
+                    out?.name(name)
+                    copyValue(inObject = true)
+                } else if (reader.peek() == JsonToken.STRING) {
+                    val value = reader.nextString()
+                    if (value == "none") out?.name(name)?.value(value)
+                } else {
+                    reader.skipValue()
+                }
+            }
+            reader.endObject()
+            out?.endObject()
+        }
+
+        /**
+         * Copies one value. Integer members of objects are port candidates; bare numbers inside
+         * arrays are not, the same rule the earlier org.json extraction followed.
+         */
+        private fun copyValue(inObject: Boolean) {
+            when (reader.peek()) {
+                JsonToken.BEGIN_OBJECT -> {
+                    reader.beginObject()
+                    out?.beginObject()
+                    while (reader.hasNext()) {
+                        val name = reader.nextName()
+                        out?.name(name)
+                        copyValue(inObject = true)
+                    }
+                    reader.endObject()
+                    out?.endObject()
+                }
+
+                JsonToken.BEGIN_ARRAY -> {
+                    reader.beginArray()
+                    out?.beginArray()
+                    while (reader.hasNext()) copyValue(inObject = false)
+                    reader.endArray()
+                    out?.endArray()
+                }
+
+                JsonToken.STRING -> {
+                    val value = reader.nextString()
+                    out?.value(value)
+                }
+
+                JsonToken.NUMBER -> {
+                    val literal = reader.nextString()
+                    if (inObject) {
+                        literal.toIntOrNull()?.takeIf { it in 1..65535 }?.let { ports.add(it) }
+                    }
+                    out?.jsonValue(literal)
+                }
+
+                JsonToken.BOOLEAN -> {
+                    val value = reader.nextBoolean()
+                    out?.value(value)
+                }
+
+                JsonToken.NULL -> {
+                    reader.nextNull()
+                    out?.nullValue()
+                }
+
+                else -> throw JSONException("Unexpected token ${reader.peek()}")
+            }
+        }
+
+        private fun writeProbe(name: String, socksPort: Int) {
+            val out = out ?: return
+            out.name(name)
+            when (name) {
+                "inbounds" -> {
+                    out.beginArray().beginObject()
+                    out.name("tag").value("probe")
+                    out.name("listen").value("127.0.0.1")
+                    out.name("port").value(socksPort)
+                    out.name("protocol").value("socks")
+                    out.name("settings").beginObject()
+                        .name("auth").value("noauth")
+                        .name("udp").value(false)
+                        .endObject()
+                    out.endObject().endArray()
+                }
+
+                "log" -> out.beginObject().name("loglevel").value("none").endObject()
+            }
+        }
+
+        private fun writeInjected(name: String, apiPort: Int) {
+            val out = out ?: return
+            out.name(name)
+            when (name) {
+                "api" -> {
+                    out.beginObject()
+                    out.name("tag").value("api")
+                    out.name("listen").value("127.0.0.1:$apiPort")
+                    // Loopback is open to every app, so the API must stay read-only.
+                    out.name("services").beginArray().value("StatsService").endArray()
+                    out.endObject()
+                }
+
+                "stats" -> out.beginObject().endObject()
+
+                "policy" -> {
+                    out.beginObject()
+                    out.name("system").beginObject()
+                        .name("statsOutboundUplink").value(true)
+                        .name("statsOutboundDownlink").value(true)
+                        .endObject()
+                    out.endObject()
+                }
+            }
+        }
+    }
+}
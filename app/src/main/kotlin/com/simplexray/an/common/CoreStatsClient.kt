@@ -23,27 +23,31 @@ class CoreStatsClient(private val channel: ManagedChannel) : Closeable {
         }.getOrNull()
     }
 
+    private val statDirections = HashMap<String, Int>()
+
     suspend fun getTraffic(): TrafficState? = withContext(Dispatchers.IO) {
         val request = QueryStatsRequest.newBuilder()
             .setPattern("outbound")
             .setReset(false)
             .build()
 
-        runCatching { blockingStub.queryStats(request) }
-            .getOrNull()
-            ?.statList
-            ?.groupBy {
-                when {
-                    it.name.endsWith("uplink") -> "uplink"
-                    it.name.endsWith("downlink") -> "downlink"
-                    else -> "other"
-                }
-            }
-            ?.let { groups ->
-                val uplink = groups["uplink"]?.sumOf { it.value } ?: 0L
-                val downlink = groups["downlink"]?.sumOf { it.value } ?: 0L
-                TrafficState(uplink, downlink)
+        val response = runCatching { blockingStub.queryStats(request) }.getOrNull()
+            ?: return@withContext null
+        var uplink = 0L
+        var downlink = 0L
+        for (stat in response.statList) {
+            when (statDirections.getOrPut(stat.name) { parseDirection(stat.name) }) {
+                DIRECTION_UPLINK -> uplink += stat.value
+                DIRECTION_DOWNLINK -> downlink += stat.value
             }
+        }
+        TrafficState(uplink, downlink)
+    }
+
+    private fun parseDirection(name: String): Int = when {
+        name.endsWith("uplink") -> DIRECTION_UPLINK
+        name.endsWith("downlink") -> DIRECTION_DOWNLINK
+        else -> DIRECTION_OTHER
     }
 
     override fun close() {
@@ -51,6 +55,10 @@ class CoreStatsClient(private val channel: ManagedChannel) : Closeable {
     }
 
     companion object {
+        private const val DIRECTION_OTHER = 0
+        private const val DIRECTION_UPLINK = 1
+        private const val DIRECTION_DOWNLINK = 2
+
         fun create(host: String, port: Int): CoreStatsClient {
             val channel = ManagedChannelBuilder.forAddress(host, port)
                 .usePlaintext()
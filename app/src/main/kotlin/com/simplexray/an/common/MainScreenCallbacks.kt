@@ -52,8 +52,8 @@ fun rememberMainScreenCallbacks(
 
     val onPerformExport: () -> Unit = {
         scope.launch {
-            val logFile = logViewModel.getLogFile()
-            if (logFile.exists() && logViewModel.logEntries.value.isNotEmpty()) {
+            val logFile = logViewModel.exportLogFile()
+            if (logFile != null && logViewModel.logEntries.value.isNotEmpty()) {
                 try {
                     val fileUri =
                         FileProvider.getUriForFile(
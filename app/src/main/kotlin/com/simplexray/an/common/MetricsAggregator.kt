@@ -0,0 +1,171 @@
+package com.simplexray.an.common
+
+import android.content.Context
+import android.os.SystemClock
+import com.simplexray.an.prefs.Preferences
+import com.simplexray.an.viewmodel.CoreStatsState
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.async
+import kotlinx.coroutines.currentCoroutineContext
+import kotlinx.coroutines.coroutineScope
+import kotlinx.coroutines.delay
+import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.flow
+import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.isActive
+import java.io.Closeable
+import kotlin.math.exp
+
+/**
+ * Merges the Xray stats API and the tunnel's shared counter region into a single
+ * [CoreStatsState], and derives smoothed per-second rates so the UI never diffs raw counters.
+ * [updates] only emits when something actually changed. The Go runtime stats are refreshed
+ * every few polls on their own cadence, stretched further while traffic is idle.
+ */
+class MetricsAggregator(private val context: Context) : Closeable {
+    private val prefs = Preferences(context)
+    private var coreStatsClient: CoreStatsClient? = null
+    private var clientPort = 0
+    private var tunnelStatsRegion: TunnelStatsRegion? = null
+
+    private val uplinkRate = EwmaRate()
+    private val downlinkRate = EwmaRate()
+    private val tunnelTxRate = EwmaRate()
+    private val tunnelRxRate = EwmaRate()
+
+    private var lastState: CoreStatsState? = null
+    private var idlePolls = 0
+    private var pollsSinceSystemStats = 0
+
+    fun updates(intervalMs: Long): Flow<CoreStatsState> = flow {
+        lastState = null
+        idlePolls = 0
+        pollsSinceSystemStats = 0
+        while (currentCoroutineContext().isActive) {
+            val previous = lastState
+            val systemInterval = if (idlePolls >= IDLE_AFTER_POLLS) IDLE_SYSTEM_STATS_POLLS
+            else SYSTEM_STATS_POLLS
+            val refreshSystem = previous == null || pollsSinceSystemStats >= systemInterval
+            pollsSinceSystemStats = if (refreshSystem) 0 else pollsSinceSystemStats + 1
+            val state = snapshot(refreshSystem)
+            if (state != null) {
+                val countersChanged = previous == null ||
+                        state.uplink != previous.uplink ||
+                        state.downlink != previous.downlink ||
+                        state.tunnelTxBytes != previous.tunnelTxBytes ||
+                        state.tunnelRxBytes != previous.tunnelRxBytes
+                idlePolls = if (countersChanged) 0 else idlePolls + 1
+                if (state != previous) emit(state)
+                lastState = state
+            } else {
+                lastState = null
+            }
+            delay(intervalMs)
+        }
+    }.flowOn(Dispatchers.IO)
+
+    private suspend fun snapshot(refreshSystem: Boolean): CoreStatsState? = coroutineScope {
+        // The service picks the API port after announcing the start and may move it on restart.
+        val apiPort = prefs.apiPort
+        if (coreStatsClient != null && clientPort != apiPort) {
+            coreStatsClient?.close()
+            coreStatsClient = null
+        }
+        val client = coreStatsClient
+            ?: CoreStatsClient.create("127.0.0.1", apiPort).also {
+                coreStatsClient = it
+                clientPort = apiPort
+            }
+        if (tunnelStatsRegion == null)
+            tunnelStatsRegion = TunnelStatsRegion.openReader(context)
+
+        val statsDeferred = if (refreshSystem) async { client.getSystemStats() } else null
+        val trafficDeferred = async { client.getTraffic() }
+        val tunnel = tunnelStatsRegion?.snapshot()
+        val stats = statsDeferred?.await()
+        val traffic = trafficDeferred.await()
+
+        if (stats == null && traffic == null) {
+            client.close()
+            coreStatsClient = null
+            return@coroutineScope null
+        }
+
+        val now = SystemClock.elapsedRealtime()
+        val uplink = traffic?.uplink ?: 0
+        val downlink = traffic?.downlink ?: 0
+        val tunnelTxBytes = tunnel?.txBytes ?: 0
+        val tunnelRxBytes = tunnel?.rxBytes ?: 0
+
+        val base = if (refreshSystem) {
+            CoreStatsState(
+                numGoroutine = stats?.numGoroutine ?: 0,
+                numGC = stats?.numGC ?: 0,
+                alloc = stats?.alloc ?: 0,
+                totalAlloc = stats?.totalAlloc ?: 0,
+                sys = stats?.sys ?: 0,
+                mallocs = stats?.mallocs ?: 0,
+                frees = stats?.frees ?: 0,
+                liveObjects = stats?.liveObjects ?: 0,
+                pauseTotalNs = stats?.pauseTotalNs ?: 0,
+                uptime = stats?.uptime ?: 0
+            )
+        } else {
+            lastState ?: CoreStatsState()
+        }
+
+        base.copy(
+            uplink = uplink,
+            downlink = downlink,
+            tunnelTxPackets = tunnel?.txPackets ?: 0,
+            tunnelTxBytes = tunnelTxBytes,
+            tunnelRxPackets = tunnel?.rxPackets ?: 0,
+            tunnelRxBytes = tunnelRxBytes,
+            tunnelTcpBufferSize = tunnel?.tcpBufferSize ?: 0,
+            tunnelMaxSessions = tunnel?.maxSessionCount ?: 0,
+            tunnelTaskStackSize = tunnel?.taskStackSize ?: 0,
+            tunnelMemoryBudget = tunnel?.memoryBudget ?: 0,
+            tunnelResidentBytes = tunnel?.residentBytes ?: 0,
+            uplinkRate = uplinkRate.update(uplink, now),
+            downlinkRate = downlinkRate.update(downlink, now),
+            tunnelTxRate = tunnelTxRate.update(tunnelTxBytes, now),
+            tunnelRxRate = tunnelRxRate.update(tunnelRxBytes, now)
+        )
+    }
+
+    override fun close() {
+        coreStatsClient?.close()
+        coreStatsClient = null
+        tunnelStatsRegion?.close()
+        tunnelStatsRegion = null
+    }
+
+    private class EwmaRate {
+        private var lastValue = -1L
+        private var lastTime = 0L
+        private var rate = 0.0
+
+        fun update(value: Long, now: Long): Long {
+            if (lastValue < 0 || value < lastValue || now <= lastTime) {
+                if (lastValue < 0 || value < lastValue) rate = 0.0
+                lastValue = value
+                lastTime = now
+                return rate.toLong()
+            }
+            val dtMs = (now - lastTime).toDouble()
+            val instant = (value - lastValue) * 1000.0 / dtMs
+            val alpha = 1 - exp(-dtMs / RATE_TIME_CONSTANT_MS)
+            rate += alpha * (instant - rate)
+            lastValue = value
+            lastTime = now
+            return rate.toLong()
+        }
+    }
+
+    companion object {
+        private const val RATE_TIME_CONSTANT_MS = 3000.0
+        private const val SYSTEM_STATS_POLLS = 5
+        private const val IDLE_SYSTEM_STATS_POLLS = 15
+        private const val IDLE_AFTER_POLLS = 5
+    }
+}
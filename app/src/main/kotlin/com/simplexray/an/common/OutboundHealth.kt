@@ -0,0 +1,72 @@
+package com.simplexray.an.common
+
+/**
+ * Smoothed latency and loss per config, fed by periodic [ConfigLatencyTester] rounds. Latency
+ * only moves on successful probes; loss moves on every probe, so one timeout marks a config as
+ * lossy without erasing what its latency was. [pickReplacement] applies the switching policy.
+ */
+class OutboundHealth {
+    private class Entry(var latencyMs: Double, var loss: Double, var samples: Int)
+
+    private val entries = HashMap<String, Entry>()
+
+    @Synchronized
+    fun record(name: String, latency: ConfigLatency?) {
+        val entry = entries[name]
+        val failed = if (latency == null) 1.0 else 0.0
+        if (entry == null) {
+            entries[name] = Entry(latency?.totalMs?.toDouble() ?: Double.NaN, failed, 1)
+            return
+        }
+        if (latency != null) {
+            entry.latencyMs = if (entry.latencyMs.isNaN()) latency.totalMs.toDouble()
+            else ewma(entry.latencyMs, latency.totalMs.toDouble())
+        }
+        entry.loss = ewma(entry.loss, failed)
+        entry.samples++
+    }
+
+    @Synchronized
+    fun retainAll(names: Set<String>) {
+        entries.keys.retainAll(names)
+    }
+
+    /** Expected time to a response, counting lost probes as retries; null if never reachable. */
+    @Synchronized
+    fun score(name: String): Double? {
+        val entry = entries[name] ?: return null
+        if (entry.latencyMs.isNaN()) return null
+        return entry.latencyMs / (1 - entry.loss).coerceAtLeast(MIN_DELIVERY)
+    }
+
+    /**
+     * The config to switch to, or null to stay. A switch needs the current config to be lossy or
+     * clearly slower than the best candidate, and the candidate to have a track record, so two
+     * configs of similar quality don't flap on noise.
+     */
+    @Synchronized
+    fun pickReplacement(current: String): String? {
+        val best = entries.entries
+            .filter { it.key != current && it.value.samples >= MIN_SAMPLES }
+            .minByOrNull { score(it.key) ?: Double.MAX_VALUE }
+            ?.key ?: return null
+        val bestScore = score(best) ?: return null
+        if (entries.getValue(best).loss > LOSS_THRESHOLD) return null
+        val currentEntry = entries[current] ?: return best
+        val currentScore = score(current) ?: return best
+        val degraded = currentEntry.loss > LOSS_THRESHOLD ||
+                (currentScore > bestScore * SWITCH_RATIO && currentScore - bestScore > MIN_GAIN_MS)
+        return if (degraded) best else null
+    }
+
+    private fun ewma(previous: Double, sample: Double) = previous + ALPHA * (sample - previous)
+
+    companion object {
+        private const val ALPHA = 0.3
+        private const val MIN_DELIVERY = 0.05
+        private const val MIN_SAMPLES = 2
+        private const val LOSS_THRESHOLD = 0.5
+        private const val SWITCH_RATIO = 1.5
+        private const val MIN_GAIN_MS = 150.0
+    }
+}
@@ -0,0 +1,110 @@
+package com.simplexray.an.common
+
+import android.util.Log
+import com.simplexray.an.BuildConfig
+import com.simplexray.an.prefs.Preferences
+import org.json.JSONException
+import java.io.File
+import java.io.IOException
+import java.security.MessageDigest
+
+/**
+ * Disk-backed memo of the work done on a config before the core can take it: the ports it
+ * already uses and its stats-injected form. Entries are keyed by the config's SHA-256 (plus the
+ * API port for the injected form), so reconnecting with an unchanged config parses nothing, and
+ * by the app's version code, since an update may change what gets injected.
+ * The service process exits on disconnect, which is why this lives on disk rather than in memory.
+ */
+class PreparedConfigCache(dir: File) {
+    private val metaFile = File(dir, "prepared_config.meta")
+    private val injectedFile = File(dir, "prepared_config.json")
+
+    private var hash: String? = null
+    private var ports: Set<Int>? = null
+    private var injectedApiPort = -1
+
+    /**
+     * A miss runs one [ConfigProcessor] pass that also injects the stats API for the current
+     * [Preferences.apiPort], since that port is usually kept and the injected form is then ready.
+     */
+    fun usedPorts(prefs: Preferences, content: String): Set<Int> {
+        load(content)
+        ports?.let { return it }
+        val apiPort = prefs.apiPort.takeIf { it in 1..65535 }
+        val result = try {
+            ConfigProcessor.process(content, apiPort = apiPort, writeOutput = apiPort != null)
+        } catch (e: JSONException) {
+            Log.e(TAG, "Error parsing JSON for port extraction", e)
+            return emptySet()
+        }
+        ports = result.ports
+        injectedApiPort = -1
+        if (apiPort != null) {
+            try {
+                injectedFile.writeText(result.content)
+                injectedApiPort = apiPort
+            } catch (e: IOException) {
+                Log.w(TAG, "Failed to cache injected config", e)
+            }
+        }
+        save()
+        return result.ports
+    }
+
+    fun injectedConfig(prefs: Preferences, content: String): String {
+        load(content)
+        val apiPort = prefs.apiPort
+        if (injectedApiPort == apiPort) {
+            try {
+                return injectedFile.readText()
+            } catch (e: IOException) {
+                Log.w(TAG, "Cached injected config unreadable", e)
+            }
+        }
+        val injected = ConfigUtils.injectStatsService(prefs, content)
+        try {
+            injectedFile.writeText(injected)
+            injectedApiPort = apiPort
+            save()
+        } catch (e: IOException) {
+            Log.w(TAG, "Failed to cache injected config", e)
+        }
+        return injected
+    }
+
+    private fun load(content: String) {
+        val contentHash = "${BuildConfig.VERSION_CODE}:${sha256(content)}"
+        if (contentHash == hash) return
+        hash = contentHash
+        ports = null
+        injectedApiPort = -1
+        val lines = try {
+            if (metaFile.exists()) metaFile.readLines() else return
+        } catch (e: IOException) {
+            return
+        }
+        if (lines.size < 3 || lines[0] != contentHash) return
+        ports = lines[1].takeIf { it != NO_PORTS }
+            ?.split(',')?.mapNotNull { it.toIntOrNull() }?.toSet()
+        injectedApiPort = lines[2].toIntOrNull() ?: -1
+    }
+
+    private fun save() {
+        try {
+            metaFile.writeText(
+                "$hash\n${ports?.joinToString(",") ?: NO_PORTS}\n$injectedApiPort\n"
+            )
+        } catch (e: IOException) {
+            Log.w(TAG, "Failed to write prepared config metadata", e)
+        }
+    }
+
+    private fun sha256(content: String): String =
+        MessageDigest.getInstance("SHA-256").digest(content.toByteArray())
+            .joinToString("") { "%02x".format(it) }
+
+    companion object {
+        private const val TAG = "PreparedConfigCache"
+        private const val NO_PORTS = "-"
+    }
+}
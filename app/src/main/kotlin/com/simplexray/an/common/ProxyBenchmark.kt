@@ -0,0 +1,475 @@
+package com.simplexray.an.common
+
+import android.util.Log
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.async
+import kotlinx.coroutines.awaitAll
+import kotlinx.coroutines.coroutineScope
+import kotlinx.coroutines.ensureActive
+import kotlinx.coroutines.sync.Semaphore
+import kotlinx.coroutines.sync.withPermit
+import kotlinx.coroutines.withContext
+import okhttp3.MediaType.Companion.toMediaType
+import okhttp3.OkHttpClient
+import okhttp3.Request
+import okhttp3.RequestBody
+import okio.BufferedSink
+import java.io.DataInputStream
+import java.io.IOException
+import java.io.OutputStream
+import java.net.DatagramPacket
+import java.net.DatagramSocket
+import java.net.InetAddress
+import java.net.InetSocketAddress
+import java.net.Proxy
+import java.net.Socket
+import java.net.URL
+import java.text.SimpleDateFormat
+import java.util.Date
+import java.util.Locale
+import java.util.concurrent.TimeUnit
+import java.util.concurrent.atomic.AtomicInteger
+import java.util.concurrent.atomic.AtomicLong
+import javax.net.ssl.SSLSocket
+import javax.net.ssl.SSLSocketFactory
+import kotlin.coroutines.coroutineContext
+import kotlin.math.abs
+import kotlin.math.ceil
+import kotlin.random.Random
+
+enum class BenchmarkStage { Latency, Handshakes, Download, Upload, Udp }
+
+data class LatencyResult(
+    val samples: Int,
+    val failures: Int,
+    val minMs: Double,
+    val p50Ms: Double,
+    val p90Ms: Double,
+    val p99Ms: Double,
+    val maxMs: Double
+)
+
+data class HandshakeResult(
+    val attempts: Int,
+    val failures: Int,
+    val concurrency: Int,
+    val perSecond: Double
+)
+
+data class ThroughputResult(
+    val streams: Int,
+    val durationMs: Long,
+    val bytes: Long,
+    val bytesPerSecond: Long
+)
+
+data class UdpResult(
+    val sent: Int,
+    val received: Int,
+    val lossPercent: Double,
+    val packetsPerSecond: Double,
+    val p50Ms: Double,
+    val p99Ms: Double,
+    val jitterMs: Double
+)
+
+data class BenchmarkReport(
+    val startedAt: String,
+    val appVersion: String,
+    val config: String?,
+    val socksEndpoint: String,
+    val target: String,
+    val latency: LatencyResult?,
+    val handshakes: HandshakeResult?,
+    val download: ThroughputResult?,
+    val upload: ThroughputResult?,
+    val udp: UdpResult?,
+    val errors: Map<String, String>
+)
+
+sealed class BenchmarkState {
+    data object Idle : BenchmarkState()
+    data class Running(val stage: BenchmarkStage) : BenchmarkState()
+    data class Finished(val report: BenchmarkReport) : BenchmarkState()
+}
+
+/**
+ * Repeatable measurements through the core's SOCKS inbound: request latency percentiles,
+ * concurrent connection setup rate, multi-stream download/upload throughput and a UDP ASSOCIATE
+ * DNS probe for packet rate, loss and jitter. Each stage is independent, so one failing stage
+ * is reported in [BenchmarkReport.errors] without hiding the others.
+ *
+ * The app excludes itself from the VPN, so everything here measures the core; the tunnel's
+ * overhead shows up by comparing against an app routed through the TUN interface.
+ */
+class ProxyBenchmark(
+    private val socksHost: String,
+    private val socksPort: Int,
+    private val socksUsername: String,
+    private val socksPassword: String,
+    private val targetUrl: String,
+    private val timeoutMs: Int
+) {
+    private val proxy = Proxy(Proxy.Type.SOCKS, InetSocketAddress(socksHost, socksPort))
+
+    suspend fun run(
+        appVersion: String,
+        config: String?,
+        onStage: (BenchmarkStage) -> Unit
+    ): BenchmarkReport = withContext(Dispatchers.IO) {
+        val startedAt = SimpleDateFormat("yyyy-MM-dd'T'HH:mm:ssZ", Locale.ROOT).format(Date())
+        val errors = LinkedHashMap<String, String>()
+
+        suspend fun <T> stage(stage: BenchmarkStage, block: suspend () -> T): T? {
+            onStage(stage)
+            return try {
+                block()
+            } catch (e: IOException) {
+                Log.w(TAG, "Benchmark stage $stage failed", e)
+                errors[stage.name] = e.message ?: e.javaClass.simpleName
+                null
+            }
+        }
+
+        val url = URL(targetUrl)
+        val latency = stage(BenchmarkStage.Latency) { measureLatency(url) }
+        val handshakes = stage(BenchmarkStage.Handshakes) { measureHandshakes(url) }
+        val client = OkHttpClient.Builder()
+            .proxy(proxy)
+            .connectTimeout(timeoutMs.toLong(), TimeUnit.MILLISECONDS)
+            .readTimeout(timeoutMs.toLong(), TimeUnit.MILLISECONDS)
+            .writeTimeout(timeoutMs.toLong(), TimeUnit.MILLISECONDS)
+            .build()
+        val download = stage(BenchmarkStage.Download) { measureDownload(client) }
+        val upload = stage(BenchmarkStage.Upload) { measureUpload(client) }
+        val udp = stage(BenchmarkStage.Udp) { measureUdp() }
+        client.dispatcher.executorService.shutdown()
+        client.connectionPool.evictAll()
+
+        BenchmarkReport(
+            startedAt = startedAt,
+            appVersion = appVersion,
+            config = config,
+            socksEndpoint = "$socksHost:$socksPort",
+            target = targetUrl,
+            latency = latency,
+            handshakes = handshakes,
+            download = download,
+            upload = upload,
+            udp = udp,
+            errors = errors
+        )
+    }
+
+    /** Sequential requests; each sample is connect, TLS if any, and time to the status line. */
+    private suspend fun measureLatency(url: URL): LatencyResult {
+        val samples = ArrayList<Double>(LATENCY_SAMPLES)
+        var failures = 0
+        repeat(LATENCY_SAMPLES) {
+            coroutineContext.ensureActive()
+            val start = System.nanoTime()
+            if (requestStatusLine(url)) {
+                samples.add((System.nanoTime() - start) / NANOS_PER_MS)
+            } else {
+                failures++
+            }
+        }
+        if (samples.isEmpty()) throw IOException("All $LATENCY_SAMPLES requests failed")
+        samples.sort()
+        return LatencyResult(
+            samples = samples.size,
+            failures = failures,
+            minMs = samples.first(),
+            p50Ms = percentile(samples, 0.50),
+            p90Ms = percentile(samples, 0.90),
+            p99Ms = percentile(samples, 0.99),
+            maxMs = samples.last()
+        )
+    }
+
+    /**
+     * Opens [HANDSHAKE_ATTEMPTS] connections, [HANDSHAKE_CONCURRENCY] at a time, each up to the
+     * point where the remote end has answered: the TLS handshake for https, first byte otherwise.
+     */
+    private suspend fun measureHandshakes(url: URL): HandshakeResult = coroutineScope {
+        val permits = Semaphore(HANDSHAKE_CONCURRENCY)
+        val failures = AtomicInteger()
+        val start = System.nanoTime()
+        (1..HANDSHAKE_ATTEMPTS).map {
+            async(Dispatchers.IO) {
+                permits.withPermit {
+                    if (!requestStatusLine(url, headOnly = true)) failures.incrementAndGet()
+                }
+            }
+        }.awaitAll()
+        val elapsedSeconds = (System.nanoTime() - start) / NANOS_PER_SECOND
+        val completed = HANDSHAKE_ATTEMPTS - failures.get()
+        if (completed == 0) throw IOException("All $HANDSHAKE_ATTEMPTS connections failed")
+        HandshakeResult(
+            attempts = HANDSHAKE_ATTEMPTS,
+            failures = failures.get(),
+            concurrency = HANDSHAKE_CONCURRENCY,
+            perSecond = completed / elapsedSeconds
+        )
+    }
+
+    private fun requestStatusLine(url: URL, headOnly: Boolean = false): Boolean {
+        val host = url.host
+        val port = if (url.port > 0) url.port else url.defaultPort
+        val path = if (url.path.isNullOrEmpty()) "/" else url.path
+        return try {
+            Socket(proxy).use { socket ->
+                socket.soTimeout = timeoutMs
+                socket.connect(InetSocketAddress(host, port), timeoutMs)
+                val stream = if (url.protocol == "https") {
+                    val sslSocket = (SSLSocketFactory.getDefault() as SSLSocketFactory)
+                        .createSocket(socket, host, port, true) as SSLSocket
+                    sslSocket.startHandshake()
+                    sslSocket
+                } else {
+                    socket
+                }
+                val method = if (headOnly) "HEAD" else "GET"
+                val writer = stream.getOutputStream().bufferedWriter()
+                writer.write("$method $path HTTP/1.1\r\nHost: $host\r\nConnection: close\r\n\r\n")
+                writer.flush()
+                stream.getInputStream().bufferedReader().readLine()?.startsWith("HTTP/") == true
+            }
+        } catch (e: IOException) {
+            false
+        }
+    }
+
+    private suspend fun measureDownload(client: OkHttpClient): ThroughputResult =
+        measureThroughput { deadline, counter ->
+            val request = Request.Builder().url(DOWNLOAD_URL).build()
+            client.newCall(request).execute().use { response ->
+                if (!response.isSuccessful) throw IOException("HTTP ${response.code}")
+                val source = response.body?.byteStream() ?: throw IOException("Empty body")
+                val buffer = ByteArray(THROUGHPUT_BUFFER_SIZE)
+                while (System.nanoTime() < deadline) {
+                    val read = source.read(buffer)
+                    if (read < 0) break
+                    counter.addAndGet(read.toLong())
+                }
+            }
+        }
+
+    private suspend fun measureUpload(client: OkHttpClient): ThroughputResult =
+        measureThroughput { deadline, counter ->
+            val payload = Random.nextBytes(THROUGHPUT_BUFFER_SIZE)
+            val body = object : RequestBody() {
+                override fun contentType() = "application/octet-stream".toMediaType()
+
+                override fun writeTo(sink: BufferedSink) {
+                    while (System.nanoTime() < deadline) {
+                        sink.write(payload)
+                        counter.addAndGet(payload.size.toLong())
+                    }
+                }
+            }
+            val request = Request.Builder().url(UPLOAD_URL).post(body).build()
+            client.newCall(request).execute().use { response ->
+                if (!response.isSuccessful) throw IOException("HTTP ${response.code}")
+            }
+        }
+
+    /** Runs [THROUGHPUT_STREAMS] transfers for [THROUGHPUT_DURATION_MS] and sums their bytes. */
+    private suspend fun measureThroughput(
+        transfer: (deadline: Long, counter: AtomicLong) -> Unit
+    ): ThroughputResult = coroutineScope {
+        val counter = AtomicLong()
+        val start = System.nanoTime()
+        val deadline = start + THROUGHPUT_DURATION_MS * 1_000_000
+        val failures = (1..THROUGHPUT_STREAMS).map {
+            async(Dispatchers.IO) {
+                try {
+                    transfer(deadline, counter)
+                    null
+                } catch (e: IOException) {
+                    e
+                }
+            }
+        }.awaitAll().filterNotNull()
+        val elapsedNanos = System.nanoTime() - start
+        val bytes = counter.get()
+        if (bytes == 0L) throw failures.firstOrNull() ?: IOException("No data transferred")
+        ThroughputResult(
+            streams = THROUGHPUT_STREAMS,
+            durationMs = elapsedNanos / 1_000_000,
+            bytes = bytes,
+            bytesPerSecond = (bytes * NANOS_PER_SECOND / elapsedNanos).toLong()
+        )
+    }
+
+    /**
+     * DNS queries relayed through a SOCKS5 UDP ASSOCIATE session, one at a time, so each reply
+     * gives an RTT sample; unanswered queries count as loss.
+     */
+    private suspend fun measureUdp(): UdpResult {
+        Socket().use { control ->
+            control.soTimeout = timeoutMs
+            control.connect(InetSocketAddress(socksHost, socksPort), timeoutMs)
+            val input = DataInputStream(control.getInputStream())
+            val output = control.getOutputStream()
+            negotiateSocks(input, output)
+            output.write(byteArrayOf(SOCKS_VERSION, SOCKS_CMD_UDP_ASSOCIATE, 0, 1, 0, 0, 0, 0, 0, 0))
+            output.flush()
+            val relay = readSocksReply(input)
+            val relayAddress = if (relay.address.isAnyLocalAddress) {
+                InetSocketAddress(socksHost, relay.port)
+            } else {
+                relay
+            }
+
+            DatagramSocket().use { udp ->
+                udp.soTimeout = UDP_REPLY_TIMEOUT_MS
+                val dnsServer = InetAddress.getByName(UDP_DNS_SERVER)
+                val rtts = ArrayList<Double>(UDP_SAMPLES)
+                val receiveBuffer = ByteArray(UDP_RECEIVE_BUFFER_SIZE)
+                val start = System.nanoTime()
+                for (i in 0 until UDP_SAMPLES) {
+                    coroutineContext.ensureActive()
+                    val id = i and 0xFFFF
+                    val datagram = socksUdpHeader(dnsServer, 53) + dnsQuery(id)
+                    val sentAt = System.nanoTime()
+                    udp.send(DatagramPacket(datagram, datagram.size, relayAddress))
+                    if (awaitDnsReply(udp, receiveBuffer, id)) {
+                        rtts.add((System.nanoTime() - sentAt) / NANOS_PER_MS)
+                    }
+                }
+                val elapsedSeconds = (System.nanoTime() - start) / NANOS_PER_SECOND
+                if (rtts.isEmpty()) throw IOException("No UDP replies through the SOCKS relay")
+                val jitter = rtts.zipWithNext { a, b -> abs(b - a) }.average()
+                    .takeIf { !it.isNaN() } ?: 0.0
+                val sorted = rtts.sorted()
+                return UdpResult(
+                    sent = UDP_SAMPLES,
+                    received = rtts.size,
+                    lossPercent = (UDP_SAMPLES - rtts.size) * 100.0 / UDP_SAMPLES,
+                    packetsPerSecond = rtts.size / elapsedSeconds,
+                    p50Ms = percentile(sorted, 0.50),
+                    p99Ms = percentile(sorted, 0.99),
+                    jitterMs = jitter
+                )
+            }
+        }
+    }
+
+    private fun awaitDnsReply(udp: DatagramSocket, buffer: ByteArray, id: Int): Boolean {
+        val deadline = System.nanoTime() + UDP_REPLY_TIMEOUT_MS * 1_000_000L
+        while (System.nanoTime() < deadline) {
+            val packet = DatagramPacket(buffer, buffer.size)
+            try {
+                udp.receive(packet)
+            } catch (e: java.net.SocketTimeoutException) {
+                return false
+            }
+            val offset = socksUdpHeaderLength(buffer, packet.length) ?: continue
+            if (packet.length < offset + 2) continue
+            val replyId = ((buffer[offset].toInt() and 0xFF) shl 8) or
+                    (buffer[offset + 1].toInt() and 0xFF)
+            if (replyId == id) return true
+        }
+        return false
+    }
+
+    private fun negotiateSocks(input: DataInputStream, output: OutputStream) {
+        val useAuth = socksUsername.isNotEmpty() && socksPassword.isNotEmpty()
+        if (useAuth) {
+            output.write(byteArrayOf(SOCKS_VERSION, 2, SOCKS_AUTH_NONE, SOCKS_AUTH_PASSWORD))
+        } else {
+            output.write(byteArrayOf(SOCKS_VERSION, 1, SOCKS_AUTH_NONE))
+        }
+        output.flush()
+        if (input.readByte() != SOCKS_VERSION) throw IOException("Not a SOCKS5 server")
+        when (input.readByte()) {
+            SOCKS_AUTH_NONE -> Unit
+            SOCKS_AUTH_PASSWORD -> {
+                val user = socksUsername.toByteArray()
+                val pass = socksPassword.toByteArray()
+                output.write(byteArrayOf(1, user.size.toByte()) + user + pass.size.toByte() + pass)
+                output.flush()
+                input.readByte()
+                if (input.readByte() != 0.toByte()) throw IOException("SOCKS authentication failed")
+            }
+
+            else -> throw IOException("No acceptable SOCKS authentication method")
+        }
+    }
+
+    private fun readSocksReply(input: DataInputStream): InetSocketAddress {
+        input.readByte()
+        val status = input.readByte().toInt()
+        if (status != 0) throw IOException("SOCKS request rejected with status $status")
+        input.readByte()
+        val address = when (input.readByte().toInt()) {
+            1 -> ByteArray(4).also { input.readFully(it) }.let { InetAddress.getByAddress(it) }
+            4 -> ByteArray(16).also { input.readFully(it) }.let { InetAddress.getByAddress(it) }
+            3 -> {
+                val name = ByteArray(input.readUnsignedByte()).also { input.readFully(it) }
+                InetAddress.getByName(String(name))
+            }
+
+            else -> throw IOException("Unknown SOCKS address type")
+        }
+        return InetSocketAddress(address, input.readUnsignedShort())
+    }
+
+    private fun socksUdpHeader(address: InetAddress, port: Int): ByteArray {
+        val raw = address.address
+        val type: Byte = if (raw.size == 4) 1 else 4
+        return byteArrayOf(0, 0, 0, type) + raw + byteArrayOf((port shr 8).toByte(), port.toByte())
+    }
+
+    private fun socksUdpHeaderLength(buffer: ByteArray, length: Int): Int? {
+        if (length < 4) return null
+        return when (buffer[3].toInt()) {
+            1 -> 10
+            4 -> 22
+            3 -> if (length > 4) 7 + (buffer[4].toInt() and 0xFF) else null
+            else -> null
+        }
+    }
+
+    /** A recursive A query for [UDP_DNS_NAME] with transaction [id]. */
+    private fun dnsQuery(id: Int): ByteArray {
+        val header = byteArrayOf(
+            (id shr 8).toByte(), id.toByte(), 1, 0, 0, 1, 0, 0, 0, 0, 0, 0
+        )
+        val name = UDP_DNS_NAME.split('.').fold(ByteArray(0)) { acc, label ->
+            acc + label.length.toByte() + label.toByteArray()
+        }
+        return header + name + byteArrayOf(0, 0, 1, 0, 1)
+    }
+
+    private fun percentile(sorted: List<Double>, fraction: Double): Double =
+        sorted[(ceil(fraction * sorted.size).toInt() - 1).coerceIn(0, sorted.size - 1)]
+
+    companion object {
+        private const val TAG = "ProxyBenchmark"
+        private const val NANOS_PER_MS = 1_000_000.0
+        private const val NANOS_PER_SECOND = 1_000_000_000.0
+
+        private const val LATENCY_SAMPLES = 20
+        private const val HANDSHAKE_ATTEMPTS = 48
+        private const val HANDSHAKE_CONCURRENCY = 8
+
+        private const val THROUGHPUT_STREAMS = 4
+        private const val THROUGHPUT_DURATION_MS = 8000L
+        private const val THROUGHPUT_BUFFER_SIZE = 64 * 1024
+        private const val DOWNLOAD_URL = "https://speed.cloudflare.com/__down?bytes=1000000000"
+        private const val UPLOAD_URL = "https://speed.cloudflare.com/__up"
+
+        private const val UDP_SAMPLES = 50
+        private const val UDP_REPLY_TIMEOUT_MS = 1000
+        private const val UDP_RECEIVE_BUFFER_SIZE = 1500
+        private const val UDP_DNS_SERVER = "1.1.1.1"
+        private const val UDP_DNS_NAME = "example.com"
+
+        private const val SOCKS_VERSION: Byte = 5
+        private const val SOCKS_CMD_UDP_ASSOCIATE: Byte = 3
+        private const val SOCKS_AUTH_NONE: Byte = 0
+        private const val SOCKS_AUTH_PASSWORD: Byte = 2
+    }
+}
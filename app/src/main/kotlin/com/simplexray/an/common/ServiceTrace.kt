@@ -0,0 +1,241 @@
+package com.simplexray.an.common
+
+import android.os.Process
+import android.os.SystemClock
+import android.os.Trace
+import android.util.JsonWriter
+import java.io.File
+import java.io.IOException
+import java.lang.ref.WeakReference
+import java.util.concurrent.atomic.AtomicInteger
+import java.util.concurrent.atomic.AtomicLongArray
+
+/**
+ * Instrumentation for the tunnel service, off unless [enabled]. A section both emits an ATrace
+ * section, so it shows up in Perfetto and systrace captures of the app, and lands in a ring owned
+ * by the calling thread, so recording never takes a lock. There are at most [MAX_RINGS] rings; a
+ * ring whose thread has died is handed to the next new thread, so IO pool churn doesn't add up,
+ * and a thread that finds them all taken isn't recorded until one frees up. [dump] writes the rings as Chrome
+ * trace-event JSON, which Perfetto UI opens directly, along with the loop lag histogram and the
+ * drop counters. While disabled every call costs one volatile read.
+ */
+object ServiceTrace {
+    enum class DropCause(val label: String) {
+        LOG_QUEUE_FULL("log_queue_full"),
+        STATS_UNAVAILABLE("stats_unavailable"),
+        FLOW_SAMPLE_FAILED("flow_sample_failed"),
+        TRACE_RINGS_FULL("trace_rings_full")
+    }
+
+    @Volatile
+    var enabled = false
+
+    private const val RING_SIZE = 4096
+    private const val MAX_RINGS = 32
+    private const val KIND_SPAN = 0
+    private const val KIND_ASYNC = 1
+    private const val KIND_COUNTER = 2
+    private const val NANOS_PER_US = 1000L
+
+    /** Upper bounds of the loop lag buckets, in ms; the last bucket is everything above. */
+    private val LAG_BUCKETS_MS = longArrayOf(1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024)
+
+    private val rings = ArrayList<Ring>()
+    /** Set only once a claim succeeds, so a thread that found every ring taken tries again. */
+    private val localRing = ThreadLocal<Ring?>()
+    private val asyncCookies = AtomicInteger()
+    private val drops = AtomicLongArray(DropCause.entries.size)
+    private val lagHistogram = AtomicLongArray(LAG_BUCKETS_MS.size + 1)
+
+    /**
+     * Single-writer ring of finished events; [count] is published after each entry is filled.
+     * The writer is whichever live thread last claimed it in [claimRing].
+     */
+    private class Ring(var tid: Int, var threadName: String, var owner: WeakReference<Thread>) {
+        val names = arrayOfNulls<String>(RING_SIZE)
+        val kinds = IntArray(RING_SIZE)
+        val starts = LongArray(RING_SIZE)
+        val values = LongArray(RING_SIZE)
+
+        @Volatile
+        var count = 0L
+
+        fun add(kind: Int, name: String, start: Long, value: Long) {
+            val index = (count % RING_SIZE).toInt()
+            names[index] = name
+            kinds[index] = kind
+            starts[index] = start
+            values[index] = value
+            count++
+        }
+
+        fun isOrphaned(): Boolean = owner.get()?.isAlive != true
+    }
+
+    /** Runs on the recording thread until it holds a ring. */
+    private fun claimRing(): Ring? {
+        val thread = Thread.currentThread()
+        val tid = Process.myTid()
+        synchronized(rings) {
+            val orphan = rings.firstOrNull { it.isOrphaned() }
+            if (orphan != null) {
+                orphan.count = 0
+                orphan.names.fill(null)
+                orphan.tid = tid
+                orphan.threadName = thread.name
+                orphan.owner = WeakReference(thread)
+                return orphan
+            }
+            if (rings.size >= MAX_RINGS) return null
+            return Ring(tid, thread.name, WeakReference(thread)).also { rings.add(it) }
+        }
+    }
+
+    private fun add(kind: Int, name: String, start: Long, value: Long) {
+        val ring = localRing.get() ?: claimRing()?.also { localRing.set(it) }
+        if (ring != null) ring.add(kind, name, start, value) else drop(DropCause.TRACE_RINGS_FULL)
+    }
+
+    fun now(): Long = SystemClock.elapsedRealtimeNanos()
+
+    /** Times [block] on the calling thread. [block] must not suspend; see [asyncSection]. */
+    inline fun <T> section(name: String, block: () -> T): T {
+        if (!enabled) return block()
+        Trace.beginSection(name)
+        val start = now()
+        try {
+            return block()
+        } finally {
+            Trace.endSection()
+            record(name, start, now() - start)
+        }
+    }
+
+    /** Like [section], but the block may suspend and resume on another thread. */
+    inline fun <T> asyncSection(name: String, block: () -> T): T {
+        if (!enabled) return block()
+        val cookie = nextCookie()
+        Trace.beginAsyncSection(name, cookie)
+        val start = now()
+        try {
+            return block()
+        } finally {
+            Trace.endAsyncSection(name, cookie)
+            recordAsync(name, start, now() - start)
+        }
+    }
+
+    fun nextCookie(): Int = asyncCookies.incrementAndGet()
+
+    /** Records a span that was timed elsewhere, e.g. a [StartupTrace] stage. */
+    fun record(name: String, start: Long, duration: Long) {
+        if (enabled) add(KIND_SPAN, name, start, duration)
+    }
+
+    fun recordAsync(name: String, start: Long, duration: Long) {
+        if (enabled) add(KIND_ASYNC, name, start, duration)
+    }
+
+    fun counter(name: String, value: Long) {
+        if (!enabled) return
+        Trace.setCounter(name, value)
+        add(KIND_COUNTER, name, now(), value)
+    }
+
+    /** Counted whether or not tracing is on, so a dump taken later still shows earlier drops. */
+    fun drop(cause: DropCause, count: Long = 1) {
+        drops.addAndGet(cause.ordinal, count)
+    }
+
+    /** How late a periodic loop woke up compared to when it asked to. */
+    fun recordLoopLag(lagMs: Long) {
+        if (!enabled) return
+        val bucket = LAG_BUCKETS_MS.indexOfFirst { lagMs < it }
+        lagHistogram.incrementAndGet(if (bucket < 0) LAG_BUCKETS_MS.size else bucket)
+        counter("loop_lag_ms", lagMs)
+    }
+
+    /**
+     * Writes everything still in the rings to [file]. Events recorded while the dump runs may be
+     * missing or, if a ring wraps under the reader, garbled; the dump is a diagnostic snapshot.
+     */
+    @Throws(IOException::class)
+    fun dump(file: File, extraCounters: Map<String, Long>) {
+        val pid = Process.myPid()
+        JsonWriter(file.bufferedWriter()).use { json ->
+            json.beginObject()
+            json.name("displayTimeUnit").value("ms")
+            json.name("traceEvents").beginArray()
+            for (ring in synchronized(rings) { rings.toList() }) {
+                json.beginObject()
+                json.name("name").value("thread_name")
+                json.name("ph").value("M")
+                json.name("pid").value(pid.toLong())
+                json.name("tid").value(ring.tid.toLong())
+                json.name("args").beginObject().name("name").value(ring.threadName).endObject()
+                json.endObject()
+                val end = ring.count
+                for (i in maxOf(0L, end - RING_SIZE) until end) {
+                    writeEvent(json, ring, (i % RING_SIZE).toInt(), pid, i)
+                }
+            }
+            json.endArray()
+            json.name("metadata").beginObject()
+            json.name("loop_lag_histogram_ms").beginObject()
+            for (i in 0 until lagHistogram.length()) {
+                val label = if (i < LAG_BUCKETS_MS.size) "<${LAG_BUCKETS_MS[i]}"
+                else ">=${LAG_BUCKETS_MS.last()}"
+                json.name(label).value(lagHistogram.get(i))
+            }
+            json.endObject()
+            json.name("drops").beginObject()
+            DropCause.entries.forEach { json.name(it.label).value(drops.get(it.ordinal)) }
+            extraCounters.forEach { (name, value) -> json.name(name).value(value) }
+            json.endObject()
+            json.endObject()
+            json.endObject()
+        }
+    }
+
+    private fun writeEvent(json: JsonWriter, ring: Ring, index: Int, pid: Int, id: Long) {
+        val name = ring.names[index] ?: return
+        val start = ring.starts[index] / NANOS_PER_US
+        val value = ring.values[index]
+        when (ring.kinds[index]) {
+            KIND_SPAN -> {
+                json.beginObject()
+                json.name("name").value(name)
+                json.name("ph").value("X")
+                json.name("ts").value(start)
+                json.name("dur").value(value / NANOS_PER_US)
+                json.name("pid").value(pid.toLong())
+                json.name("tid").value(ring.tid.toLong())
+                json.endObject()
+            }
+
+            KIND_ASYNC -> {
+                for ((phase, ts) in listOf("b" to start, "e" to start + value / NANOS_PER_US)) {
+                    json.beginObject()
+                    json.name("name").value(name)
+                    json.name("cat").value("async")
+                    json.name("ph").value(phase)
+                    json.name("id").value("${ring.tid}:$id")
+                    json.name("ts").value(ts)
+                    json.name("pid").value(pid.toLong())
+                    json.name("tid").value(ring.tid.toLong())
+                    json.endObject()
+                }
+            }
+
+            KIND_COUNTER -> {
+                json.beginObject()
+                json.name("name").value(name)
+                json.name("ph").value("C")
+                json.name("ts").value(start)
+                json.name("pid").value(pid.toLong())
+                json.name("args").beginObject().name("value").value(value).endObject()
+                json.endObject()
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+package com.simplexray.an.common
+
+import android.os.SystemClock
+import java.util.concurrent.atomic.AtomicInteger
+
+/**
+ * Per-stage timings of one connect or reload. Stages may run concurrently on different threads;
+ * each of the [parts] that make up the startup calls [complete] when it is done, and the last one
+ * writes a single summary line to [sink] with every stage's start offset and duration.
+ */
+class StartupTrace(
+    private val label: String,
+    parts: Int,
+    private val sink: (String) -> Unit
+) {
+    private val startNanos = SystemClock.elapsedRealtimeNanos()
+    private val pending = AtomicInteger(parts)
+    private val stages = ArrayList<String>()
+
+    inline fun <T> stage(name: String, block: () -> T): T {
+        val start = now()
+        try {
+            return block()
+        } finally {
+            record(name, start, now())
+        }
+    }
+
+    fun mark(name: String) {
+        val at = now()
+        record(name, at, at)
+    }
+
+    fun complete() {
+        if (pending.decrementAndGet() != 0) return
+        val total = (now() - startNanos) / NANOS_PER_MS
+        val summary = synchronized(stages) { stages.joinToString(", ") }
+        sink("$label trace: $summary; total ${total}ms")
+    }
+
+    fun now(): Long = SystemClock.elapsedRealtimeNanos()
+
+    fun record(name: String, start: Long, end: Long) {
+        val offset = (start - startNanos) / NANOS_PER_MS
+        val duration = (end - start) / NANOS_PER_MS
+        synchronized(stages) { stages.add("$name +${offset}ms ${duration}ms") }
+        ServiceTrace.record("startup.$name", start, end - start)
+    }
+
+    companion object {
+        private const val NANOS_PER_MS = 1_000_000L
+    }
+}
@@ -0,0 +1,28 @@
+package com.simplexray.an.common
+
+/**
+ * Size of the tunnel's per-session TCP relay buffer (`misc.tcp-buffer-size`). A session never has
+ * more than one buffer in flight towards the SOCKS side, so a buffer below the bandwidth-delay
+ * product caps that session at size / RTT no matter what the link carries. The adaptive mode
+ * sizes it from the last measured RTT and peak rate, rounded up to a power of two.
+ */
+object TcpBufferSizing {
+    const val ADAPTIVE = 0
+    const val DEFAULT_SIZE = 65536
+    const val MIN_SIZE = 4096
+    const val MAX_SIZE = 4194304
+
+    private const val ADAPTIVE_MIN_SIZE = 16384
+    private const val ADAPTIVE_MAX_SIZE = 1048576
+
+    fun effectiveSize(configured: Int, rttMs: Int, bytesPerSecond: Long): Int {
+        if (configured != ADAPTIVE) return configured
+        if (rttMs <= 0 || bytesPerSecond <= 0) return DEFAULT_SIZE
+        val bdp = (bytesPerSecond * rttMs / 1000).coerceIn(
+            ADAPTIVE_MIN_SIZE.toLong(),
+            ADAPTIVE_MAX_SIZE.toLong()
+        ).toInt()
+        val rounded = Integer.highestOneBit(bdp)
+        return if (rounded == bdp) bdp else rounded shl 1
+    }
+}
@@ -0,0 +1,69 @@
+package com.simplexray.an.common
+
+import android.app.ActivityManager
+import android.content.Context
+import android.system.Os
+import android.system.OsConstants
+import java.io.File
+import java.io.IOException
+
+/**
+ * Memory the tunnel may spend on sessions, derived from the device's RAM. Every session owns a
+ * task stack and its TCP relay buffers, so the budget becomes a smaller stack on low-memory
+ * devices and a `max-session-count` that makes the tunnel refuse new sessions instead of growing
+ * until the low-memory killer takes the VPN down. Idle sessions are reclaimed by the tunnel's
+ * read/write timeouts. The tunnel always gets room for [MIN_SESSIONS] sessions; if the requested
+ * TCP buffer is too large for that, [tcpBufferSize] is lowered to fit rather than the budget being
+ * exceeded.
+ */
+class TunnelMemoryBudget(
+    val budgetBytes: Long,
+    val taskStackSize: Int,
+    val maxSessionCount: Int,
+    val tcpBufferSize: Int
+) {
+    companion object {
+        private const val MIN_BUDGET: Long = 32L * 1024 * 1024
+        private const val MAX_BUDGET: Long = 256L * 1024 * 1024
+        private const val BUDGET_FRACTION = 24
+        private const val LOW_MEMORY_THRESHOLD: Long = 4L * 1024 * 1024 * 1024
+        private const val LOW_MEMORY_STACK_SIZE = 49152
+        private const val MIN_SESSIONS = 256
+        private const val MAX_SESSIONS = 65535
+
+        fun forDevice(context: Context, defaultStackSize: Int, tcpBufferSize: Int): TunnelMemoryBudget {
+            val activityManager =
+                context.getSystemService(Context.ACTIVITY_SERVICE) as ActivityManager
+            val memoryInfo = ActivityManager.MemoryInfo()
+            activityManager.getMemoryInfo(memoryInfo)
+            val lowMemory = activityManager.isLowRamDevice ||
+                    memoryInfo.totalMem < LOW_MEMORY_THRESHOLD
+            val budget = (memoryInfo.totalMem / BUDGET_FRACTION).coerceIn(MIN_BUDGET, MAX_BUDGET)
+            val stackSize = if (lowMemory) minOf(defaultStackSize, LOW_MEMORY_STACK_SIZE)
+            else defaultStackSize
+            var bufferSize = tcpBufferSize
+            if (budget / (stackSize.toLong() + 2L * bufferSize) < MIN_SESSIONS) {
+                val fitting = ((budget / MIN_SESSIONS - stackSize) / 2).toInt()
+                bufferSize = Integer.highestOneBit(fitting.coerceAtLeast(TcpBufferSizing.MIN_SIZE))
+            }
+            val perSession = stackSize.toLong() + 2L * bufferSize
+            val sessions = (budget / perSession).coerceIn(
+                MIN_SESSIONS.toLong(),
+                MAX_SESSIONS.toLong()
+            ).toInt()
+            return TunnelMemoryBudget(budget, stackSize, sessions, bufferSize)
+        }
+
+        private val pageSize by lazy { Os.sysconf(OsConstants._SC_PAGESIZE) }
+
+        /** Resident set of the calling process, from the second field of `/proc/self/statm`. */
+        fun residentBytes(): Long = try {
+            val pages = File("/proc/self/statm").readText().split(' ')[1].toLong()
+            pages * pageSize
+        } catch (e: IOException) {
+            0
+        } catch (e: NumberFormatException) {
+            0
+        }
+    }
+}
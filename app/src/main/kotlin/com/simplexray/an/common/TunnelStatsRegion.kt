@@ -0,0 +1,191 @@
+package com.simplexray.an.common
+
+import android.content.Context
+import android.os.SystemClock
+import android.util.Log
+import java.io.Closeable
+import java.io.File
+import java.io.IOException
+import java.io.RandomAccessFile
+import java.nio.MappedByteBuffer
+import java.nio.channels.FileChannel
+
+data class TunnelStats(
+    val txPackets: Long = 0,
+    val txBytes: Long = 0,
+    val rxPackets: Long = 0,
+    val rxBytes: Long = 0,
+    val updatedAt: Long = 0,
+    val tcpBufferSize: Int = 0,
+    val maxSessionCount: Int = 0,
+    val taskStackSize: Int = 0,
+    val memoryBudget: Long = 0,
+    val residentBytes: Long = 0
+)
+
+/**
+ * Fixed-size counter block shared between the tunnel process and the UI through a memory-mapped
+ * file. Plain buffer accesses carry no ordering between processes, so every write and every copy
+ * runs under a lock on the file; taking and dropping it enters the kernel, which orders the
+ * mapped stores for the other side. The writer holds it for a handful of stores once a second,
+ * so a reader never waits long.
+ */
+class TunnelStatsRegion private constructor(
+    private val channel: FileChannel,
+    private val buffer: MappedByteBuffer
+) : Closeable {
+
+    /** Set by [clear]; a publish still in flight when the tunnel stops must not undo it. */
+    private var retired = false
+
+    @Synchronized
+    fun publish(stats: LongArray, residentBytes: Long) {
+        if (retired) return
+        withLock(shared = false) {
+            for (i in 0 until minOf(stats.size, NATIVE_FIELD_COUNT)) {
+                buffer.putLong(OFFSET_NATIVE_FIELDS + i * Long.SIZE_BYTES, stats[i])
+            }
+            buffer.putLong(OFFSET_RESIDENT_BYTES, residentBytes)
+            buffer.putLong(OFFSET_UPDATED_AT, SystemClock.elapsedRealtime())
+        }
+    }
+
+    /** Effective tunnel settings, published once per tunnel start next to the counters. */
+    @Synchronized
+    fun publishConfig(tcpBufferSize: Int, budget: TunnelMemoryBudget?) {
+        if (retired) return
+        withLock(shared = false) {
+            buffer.putInt(OFFSET_TCP_BUFFER_SIZE, tcpBufferSize)
+            buffer.putInt(OFFSET_MAX_SESSION_COUNT, budget?.maxSessionCount ?: 0)
+            buffer.putInt(OFFSET_TASK_STACK_SIZE, budget?.taskStackSize ?: 0)
+            buffer.putLong(OFFSET_MEMORY_BUDGET, budget?.budgetBytes ?: 0)
+        }
+    }
+
+    /** Zeroes the block for readers and ignores any later publish through this instance. */
+    @Synchronized
+    fun clear() {
+        retired = true
+        withLock(shared = false) {
+            for (i in 0 until NATIVE_FIELD_COUNT) {
+                buffer.putLong(OFFSET_NATIVE_FIELDS + i * Long.SIZE_BYTES, 0)
+            }
+            buffer.putInt(OFFSET_TCP_BUFFER_SIZE, 0)
+            buffer.putInt(OFFSET_MAX_SESSION_COUNT, 0)
+            buffer.putInt(OFFSET_TASK_STACK_SIZE, 0)
+            buffer.putLong(OFFSET_MEMORY_BUDGET, 0)
+            buffer.putLong(OFFSET_RESIDENT_BYTES, 0)
+            buffer.putLong(OFFSET_UPDATED_AT, 0)
+        }
+    }
+
+    /** A consistent copy of the block, or null if the lock can't be taken. */
+    @Synchronized
+    fun snapshot(): TunnelStats? {
+        buffer.putLong(OFFSET_READER_HEARTBEAT, SystemClock.elapsedRealtime())
+        return withLock(shared = true) {
+            TunnelStats(
+                txPackets = buffer.getLong(OFFSET_NATIVE_FIELDS),
+                txBytes = buffer.getLong(OFFSET_NATIVE_FIELDS + Long.SIZE_BYTES),
+                rxPackets = buffer.getLong(OFFSET_NATIVE_FIELDS + 2 * Long.SIZE_BYTES),
+                rxBytes = buffer.getLong(OFFSET_NATIVE_FIELDS + 3 * Long.SIZE_BYTES),
+                updatedAt = buffer.getLong(OFFSET_UPDATED_AT),
+                tcpBufferSize = buffer.getInt(OFFSET_TCP_BUFFER_SIZE),
+                maxSessionCount = buffer.getInt(OFFSET_MAX_SESSION_COUNT),
+                taskStackSize = buffer.getInt(OFFSET_TASK_STACK_SIZE),
+                memoryBudget = buffer.getLong(OFFSET_MEMORY_BUDGET),
+                residentBytes = buffer.getLong(OFFSET_RESIDENT_BYTES)
+            )
+        }
+    }
+
+    /**
+     * Runs [block] holding a lock on the counters. The heartbeat is left outside it: it is a
+     * single store only the reader side writes. Callers are synchronized, since one process
+     * may not hold overlapping locks on the file.
+     */
+    private inline fun <T> withLock(shared: Boolean, block: () -> T): T? {
+        val lock = try {
+            channel.lock(OFFSET_LOCKED, REGION_SIZE - OFFSET_LOCKED, shared)
+        } catch (e: IOException) {
+            Log.w(TAG, "Failed to lock tunnel stats region", e)
+            return null
+        }
+        try {
+            return block()
+        } finally {
+            lock.release()
+        }
+    }
+
+    fun hasActiveReader(): Boolean {
+        val heartbeat = buffer.getLong(OFFSET_READER_HEARTBEAT)
+        return heartbeat > 0 && SystemClock.elapsedRealtime() - heartbeat < READER_TIMEOUT_MS
+    }
+
+    override fun close() {
+        try {
+            channel.close()
+        } catch (e: IOException) {
+            Log.w(TAG, "Error closing tunnel stats region", e)
+        }
+    }
+
+    companion object {
+        private const val TAG = "TunnelStatsRegion"
+        private const val FILE_NAME = "tunnel_stats"
+        private const val MAGIC = 0x53585453
+        private const val NATIVE_FIELD_COUNT = 4
+        private const val READER_TIMEOUT_MS = 5000L
+
+        private const val OFFSET_MAGIC = 0
+        /** Start of the range [withLock] covers: everything past the magic. */
+        private const val OFFSET_LOCKED = 8L
+        private const val OFFSET_UPDATED_AT = 16
+        private const val OFFSET_READER_HEARTBEAT = 24
+        private const val OFFSET_NATIVE_FIELDS = 32
+        private const val OFFSET_TCP_BUFFER_SIZE = 64
+        private const val OFFSET_MAX_SESSION_COUNT = 68
+        private const val OFFSET_TASK_STACK_SIZE = 72
+        private const val OFFSET_MEMORY_BUDGET = 80
+        private const val OFFSET_RESIDENT_BYTES = 88
+        private const val REGION_SIZE = 256L
+
+        fun openWriter(context: Context): TunnelStatsRegion? =
+            open(File(context.noBackupFilesDir, FILE_NAME), create = true)
+
+        fun openReader(context: Context): TunnelStatsRegion? {
+            val file = File(context.noBackupFilesDir, FILE_NAME)
+            if (!file.exists()) return null
+            return open(file, create = false)
+        }
+
+        private fun open(file: File, create: Boolean): TunnelStatsRegion? {
+            return try {
+                val raf = RandomAccessFile(file, "rw")
+                if (create && raf.length() < REGION_SIZE) {
+                    raf.setLength(REGION_SIZE)
+                } else if (raf.length() < REGION_SIZE) {
+                    raf.close()
+                    return null
+                }
+                val channel = raf.channel
+                val buffer = channel.map(FileChannel.MapMode.READ_WRITE, 0, REGION_SIZE)
+                if (create) {
+                    // The file outlives the process, so start from an empty block.
+                    for (offset in OFFSET_LOCKED.toInt() until REGION_SIZE.toInt() step Long.SIZE_BYTES) {
+                        buffer.putLong(offset, 0)
+                    }
+                    buffer.putInt(OFFSET_MAGIC, MAGIC)
+                } else if (buffer.getInt(OFFSET_MAGIC) != MAGIC) {
+                    channel.close()
+                    return null
+                }
+                TunnelStatsRegion(channel, buffer)
+            } catch (e: IOException) {
+                Log.e(TAG, "Failed to map tunnel stats region: ${file.absolutePath}", e)
+                null
+            }
+        }
+    }
+}
@@ -0,0 +1,317 @@
+package com.simplexray.an.common.log
+
+/**
+ * Interned strings shared by every [LogRecordStore] of an index. Once [MAX_ENTRIES] distinct values
+ * have been seen, [intern] refuses new ones and callers fall back to storing text verbatim.
+ */
+internal class LogStringTable {
+    private val ids = HashMap<String, Int>()
+    private val values = ArrayList<String>()
+
+    fun intern(value: String): Int {
+        ids[value]?.let { return it }
+        if (values.size >= MAX_ENTRIES) return NONE
+        val id = values.size
+        values.add(value)
+        ids[value] = id
+        return id
+    }
+
+    operator fun get(id: Int): String = values[id]
+
+    fun clear() {
+        ids.clear()
+        values.clear()
+    }
+
+    companion object {
+        const val NONE = -1
+        private const val MAX_ENTRIES = 8192
+    }
+}
+
+/**
+ * Append-only columnar store of parsed log lines. Each Xray line is split once on ingest into a
+ * packed timestamp, level, connection id, interned component and interned message template; the
+ * variable tokens of the message (addresses, hosts, ports, counters) go into a UTF-8 arena.
+ * The parse is lossless by construction, so [format] rebuilds the exact original text, and the UI
+ * only calls it for the rows it actually draws. Lines that don't follow the Xray layout are kept
+ * verbatim in the arena.
+ */
+internal class LogRecordStore(private val strings: LogStringTable) {
+    var size = 0
+        private set
+
+    private var timestamps = LongArray(INITIAL_CAPACITY)
+    private var flags = ByteArray(INITIAL_CAPACITY)
+    private var connectionIds = IntArray(INITIAL_CAPACITY)
+    private var components = IntArray(INITIAL_CAPACITY)
+    private var templates = IntArray(INITIAL_CAPACITY)
+    private var argOffsets = IntArray(INITIAL_CAPACITY + 1)
+    private var arena = ByteArray(INITIAL_ARENA_CAPACITY)
+    private var arenaSize = 0
+
+    private val templateBuilder = StringBuilder()
+
+    fun add(line: String) {
+        ensureCapacity()
+        val index = size
+        if (line.indexOf(ARG_SEPARATOR) >= 0 || !parse(line, index)) {
+            timestamps[index] = 0
+            flags[index] = LogLevel.parse(line).ordinal.toByte()
+            connectionIds[index] = 0
+            components[index] = LogStringTable.NONE
+            templates[index] = RAW_TEMPLATE
+            arenaSize = argOffsets[index]
+            appendArena(line)
+        }
+        size++
+        argOffsets[size] = arenaSize
+    }
+
+    fun clear() {
+        size = 0
+        arenaSize = 0
+    }
+
+    fun level(index: Int): LogLevel = LEVELS[flags[index].toInt() and LEVEL_MASK]
+
+    fun connectionId(index: Int): Int = connectionIds[index]
+
+    fun format(index: Int): String {
+        val argStart = argOffsets[index]
+        val argEnd = argOffsets[index + 1]
+        val template = templates[index]
+        if (template == RAW_TEMPLATE) {
+            return String(arena, argStart, argEnd - argStart, Charsets.UTF_8)
+        }
+        val out = StringBuilder(64 + argEnd - argStart)
+        val flag = flags[index].toInt()
+        val timestampKind = flag shr TIMESTAMP_SHIFT
+        if (timestampKind != TIMESTAMP_NONE) {
+            appendTimestamp(out, timestamps[index], timestampKind == TIMESTAMP_MICROS)
+            out.append(' ')
+        }
+        val level = LEVELS[flag and LEVEL_MASK]
+        if (level != LogLevel.Unknown) out.append('[').append(level.name).append("] ")
+        val connectionId = connectionIds[index]
+        if (connectionId != 0) {
+            out.append('[').append(connectionId.toUInt()).append("] ")
+        }
+        val component = components[index]
+        if (component != LogStringTable.NONE) out.append(strings[component]).append(": ")
+
+        var argPos = argStart
+        for (c in strings[template]) {
+            if (c != ARG_SEPARATOR) {
+                out.append(c)
+                continue
+            }
+            var argEndPos = argPos
+            while (arena[argEndPos] != 0.toByte()) argEndPos++
+            out.append(String(arena, argPos, argEndPos - argPos, Charsets.UTF_8))
+            argPos = argEndPos + 1
+        }
+        return out.toString()
+    }
+
+    /**
+     * Splits [line] as `[timestamp ][[Level] ][[connection] ][component: ]message`. Every part is
+     * only accepted when its fixed-width or canonical form guarantees [format] reproduces it.
+     */
+    private fun parse(line: String, index: Int): Boolean {
+        var pos = 0
+        var timestamp = 0L
+        var timestampKind = TIMESTAMP_NONE
+        if (line.length > SECONDS_TIMESTAMP_LENGTH && matchesSecondsTimestamp(line)) {
+            timestamp = packTimestamp(line)
+            if (timestamp < 0) return false
+            timestampKind = TIMESTAMP_SECONDS
+            pos = SECONDS_TIMESTAMP_LENGTH
+            if (line.length > MICROS_TIMESTAMP_LENGTH && line[pos] == '.' &&
+                allDigits(line, pos + 1, MICROS_TIMESTAMP_LENGTH)
+            ) {
+                timestamp = timestamp or parseDigits(line, pos + 1, MICROS_TIMESTAMP_LENGTH)
+                timestampKind = TIMESTAMP_MICROS
+                pos = MICROS_TIMESTAMP_LENGTH
+            }
+            if (line[pos] != ' ') return false
+            pos++
+        }
+
+        var level = LogLevel.Unknown
+        if (pos < line.length && line[pos] == '[') {
+            val close = line.indexOf("] ", pos + 1)
+            if (close > 0 && close - pos <= MAX_LEVEL_LENGTH) {
+                val name = line.substring(pos + 1, close)
+                val parsed = LEVELS.firstOrNull { it != LogLevel.Unknown && it.name == name }
+                if (parsed != null) {
+                    level = parsed
+                    pos = close + 2
+                }
+            }
+        }
+
+        var connectionId = 0
+        if (pos < line.length && line[pos] == '[') {
+            val close = line.indexOf("] ", pos + 1)
+            val digits = close - pos - 1
+            if (close > 0 && digits in 1..MAX_CONNECTION_ID_DIGITS && line[pos + 1] != '0' &&
+                allDigits(line, pos + 1, close)
+            ) {
+                val value = parseDigits(line, pos + 1, close)
+                if (value <= UInt.MAX_VALUE.toLong()) {
+                    connectionId = value.toInt()
+                    pos = close + 2
+                }
+            }
+        }
+
+        var component = LogStringTable.NONE
+        val colon = line.indexOf(": ", pos)
+        if (colon > pos && colon - pos <= MAX_COMPONENT_LENGTH && line.indexOf(' ', pos) > colon) {
+            component = strings.intern(line.substring(pos, colon))
+            if (component == LogStringTable.NONE) return false
+            pos = colon + 2
+        }
+
+        templateBuilder.setLength(0)
+        arenaSize = argOffsets[index]
+        var tokenStart = pos
+        while (tokenStart <= line.length) {
+            var tokenEnd = line.indexOf(' ', tokenStart)
+            if (tokenEnd < 0) tokenEnd = line.length
+            if (isVariableToken(line, tokenStart, tokenEnd)) {
+                templateBuilder.append(ARG_SEPARATOR)
+                appendArena(line.substring(tokenStart, tokenEnd))
+                ensureArena(1)
+                arena[arenaSize++] = 0
+            } else {
+                templateBuilder.append(line, tokenStart, tokenEnd)
+            }
+            if (tokenEnd < line.length) templateBuilder.append(' ')
+            tokenStart = tokenEnd + 1
+        }
+        val template = strings.intern(templateBuilder.toString())
+        if (template == LogStringTable.NONE) return false
+
+        timestamps[index] = timestamp
+        flags[index] = ((timestampKind shl TIMESTAMP_SHIFT) or level.ordinal).toByte()
+        connectionIds[index] = connectionId
+        components[index] = component
+        templates[index] = template
+        return true
+    }
+
+    private fun appendArena(text: String) {
+        val bytes = text.toByteArray(Charsets.UTF_8)
+        ensureArena(bytes.size)
+        System.arraycopy(bytes, 0, arena, arenaSize, bytes.size)
+        arenaSize += bytes.size
+    }
+
+    private fun ensureArena(extra: Int) {
+        if (arenaSize + extra <= arena.size) return
+        arena = arena.copyOf(maxOf(arena.size * 2, arenaSize + extra))
+    }
+
+    private fun ensureCapacity() {
+        if (size < timestamps.size) return
+        val capacity = timestamps.size * 2
+        timestamps = timestamps.copyOf(capacity)
+        flags = flags.copyOf(capacity)
+        connectionIds = connectionIds.copyOf(capacity)
+        components = components.copyOf(capacity)
+        templates = templates.copyOf(capacity)
+        argOffsets = argOffsets.copyOf(capacity + 1)
+    }
+
+    companion object {
+        private val LEVELS = LogLevel.entries.toTypedArray()
+        private const val LEVEL_MASK = 0x7
+        private const val TIMESTAMP_SHIFT = 3
+        private const val TIMESTAMP_NONE = 0
+        private const val TIMESTAMP_SECONDS = 1
+        private const val TIMESTAMP_MICROS = 2
+
+        private const val RAW_TEMPLATE = -2
+        private const val ARG_SEPARATOR = '\u0000'
+        private const val MAX_LEVEL_LENGTH = 8
+        private const val MAX_CONNECTION_ID_DIGITS = 10
+        private const val MAX_COMPONENT_LENGTH = 64
+        private const val INITIAL_CAPACITY = 256
+        private const val INITIAL_ARENA_CAPACITY = 16 * 1024
+
+        /** `yyyy/MM/dd HH:mm:ss`, optionally followed by `.SSSSSS`. */
+        private const val SECONDS_TIMESTAMP_LENGTH = 19
+        private const val MICROS_TIMESTAMP_LENGTH = 26
+        private const val TIMESTAMP_PATTERN = "dddd/dd/dd dd:dd:dd"
+
+        // Field layout of a packed timestamp, from the most significant end:
+        // year(14) month(4) day(5) hour(5) minute(6) second(6) micros(20).
+        private const val MICROS_BITS = 20
+        private val FIELD_STARTS = intArrayOf(0, 5, 8, 11, 14, 17)
+        private val FIELD_LENGTHS = intArrayOf(4, 2, 2, 2, 2, 2)
+        private val FIELD_SHIFTS = intArrayOf(46, 42, 37, 32, 26, MICROS_BITS)
+        private val FIELD_MASKS = longArrayOf(0x3FFF, 0xF, 0x1F, 0x1F, 0x3F, 0x3F)
+
+        private fun matchesSecondsTimestamp(line: String): Boolean {
+            for (i in TIMESTAMP_PATTERN.indices) {
+                val expected = TIMESTAMP_PATTERN[i]
+                val c = line[i]
+                if (if (expected == 'd') c !in '0'..'9' else c != expected) return false
+            }
+            return true
+        }
+
+        /** Returns -1 when a field doesn't fit its bits, e.g. a month of 42. */
+        private fun packTimestamp(line: String): Long {
+            var packed = 0L
+            for (i in FIELD_STARTS.indices) {
+                val start = FIELD_STARTS[i]
+                val value = parseDigits(line, start, start + FIELD_LENGTHS[i])
+                if (value > FIELD_MASKS[i]) return -1
+                packed = packed or (value shl FIELD_SHIFTS[i])
+            }
+            return packed
+        }
+
+        private fun appendTimestamp(out: StringBuilder, packed: Long, withMicros: Boolean) {
+            for (i in FIELD_STARTS.indices) {
+                if (i > 0) out.append(TIMESTAMP_PATTERN[FIELD_STARTS[i] - 1])
+                val value = (packed shr FIELD_SHIFTS[i]) and FIELD_MASKS[i]
+                appendPadded(out, value, FIELD_LENGTHS[i])
+            }
+            if (withMicros) {
+                out.append('.')
+                appendPadded(out, packed and ((1L shl MICROS_BITS) - 1), 6)
+            }
+        }
+
+        private fun appendPadded(out: StringBuilder, value: Long, width: Int) {
+            val text = value.toString()
+            for (i in text.length until width) out.append('0')
+            out.append(text)
+        }
+
+        private fun allDigits(text: String, start: Int, end: Int): Boolean {
+            for (i in start until end) if (text[i] !in '0'..'9') return false
+            return true
+        }
+
+        /** Addresses, ports, hosts and counters: anything with a digit, dot or colon. */
+        private fun isVariableToken(text: String, start: Int, end: Int): Boolean {
+            for (i in start until end) {
+                val c = text[i]
+                if (c in '0'..'9' || c == '.' || c == ':') return true
+            }
+            return false
+        }
+
+        private fun parseDigits(text: String, start: Int, end: Int): Long {
+            var value = 0L
+            for (i in start until end) value = value * 10 + (text[i] - '0')
+            return value
+        }
+    }
+}
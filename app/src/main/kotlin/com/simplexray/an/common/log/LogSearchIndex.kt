@@ -0,0 +1,317 @@
+package com.simplexray.an.common.log
+
+enum class LogLevel {
+    Debug, Info, Warning, Error, Unknown;
+
+    companion object {
+        /**
+         * Picks the level out of Xray's `date time [Level] message` prefix. Only the first
+         * bracketed token is considered, so message bodies containing brackets are not misread.
+         */
+        fun parse(line: String): LogLevel {
+            val open = line.indexOf('[')
+            if (open < 0 || open > MAX_PREFIX_LENGTH) return Unknown
+            val close = line.indexOf(']', open + 1)
+            if (close < 0) return Unknown
+            return when (line.substring(open + 1, close)) {
+                "Debug" -> Debug
+                "Info" -> Info
+                "Warning" -> Warning
+                "Error" -> Error
+                else -> Unknown
+            }
+        }
+
+        private const val MAX_PREFIX_LENGTH = 32
+    }
+}
+
+class SearchResult internal constructor(
+    val query: String,
+    val minLevel: LogLevel?,
+    val connectionId: Int?,
+    internal val ids: IntArray,
+    internal val firstId: Int,
+    internal val lastId: Int,
+    internal val generation: Int
+) {
+    val size: Int get() = ids.size
+}
+
+/**
+ * In-memory line store with a block-granular trigram index, fed incrementally as lines arrive.
+ * Lines are kept as compact [LogRecordStore] records and only turned back into text on access.
+ * Line ids grow for newer lines and shrink for older lines paged in from disk, so both directions
+ * can be appended without renumbering. Each trigram maps to the blocks of [BLOCK_SIZE] lines that
+ * contain it; a query only scans the blocks of its rarest trigram.
+ */
+class LogSearchIndex {
+    private val strings = LogStringTable()
+    private val newer = LogRecordStore(strings)
+    private val older = LogRecordStore(strings)
+    private val postings = HashMap<Long, BlockList>()
+    private var generation = 0
+
+    @get:Synchronized
+    val firstId: Int get() = -older.size
+
+    @get:Synchronized
+    val lastId: Int get() = newer.size - 1
+
+    @Synchronized
+    fun appendNewer(lines: List<String>) {
+        for (line in lines) {
+            val id = newer.size
+            newer.add(line)
+            indexLine(id, line)
+        }
+    }
+
+    /**
+     * Adds [lines], given oldest first, in front of everything already indexed.
+     */
+    @Synchronized
+    fun appendOlder(lines: List<String>) {
+        for (i in lines.indices.reversed()) {
+            val line = lines[i]
+            older.add(line)
+            indexLine(-older.size, line)
+        }
+    }
+
+    @Synchronized
+    fun clear() {
+        newer.clear()
+        older.clear()
+        strings.clear()
+        postings.clear()
+        generation++
+    }
+
+    @Synchronized
+    fun line(id: Int): String = if (id >= 0) newer.format(id) else older.format(-id - 1)
+
+    /** Every indexed line, newest first, formatted on access. */
+    @Synchronized
+    fun lines(): List<String> = LineView(null, lastId - firstId + 1, lastId, generation)
+
+    /** Lines of [result], newest first, formatted on access. */
+    @Synchronized
+    fun lines(result: SearchResult): List<String> =
+        LineView(result.ids, result.ids.size, result.lastId, result.generation)
+
+    @Synchronized
+    private fun lineIfCurrent(viewGeneration: Int, id: Int): String =
+        if (viewGeneration == generation) line(id) else ""
+
+    private fun level(id: Int): LogLevel =
+        if (id >= 0) newer.level(id) else older.level(-id - 1)
+
+    /**
+     * Returns matching line ids, newest first, optionally restricted to lines at or above
+     * [minLevel] and to a single [connectionId]. When [query] extends the query of [previous], only
+     * its matches are rechecked, plus whatever lines were added since. The monitor is only held for
+     * one block of lines at a time, so rows keep formatting while a long search runs; ids within
+     * the bounds taken at the start stay valid as lines are appended, and a [clear] in between
+     * abandons the search. [isCancelled] is polled between blocks so a superseded search can bail
+     * out early; null means the search was cancelled or abandoned.
+     */
+    fun search(
+        query: String,
+        minLevel: LogLevel?,
+        connectionId: Int?,
+        previous: SearchResult?,
+        isCancelled: () -> Boolean = { false }
+    ): SearchResult? {
+        val first: Int
+        val last: Int
+        val searchGeneration: Int
+        val blocks: IntArray?
+        synchronized(this) {
+            first = firstId
+            last = lastId
+            searchGeneration = generation
+            blocks = candidateBlocks(query)
+        }
+        val scan = Scan(query, minLevel, connectionId, searchGeneration, isCancelled)
+
+        if (previous != null &&
+            previous.generation == searchGeneration &&
+            previous.minLevel == minLevel &&
+            previous.connectionId == connectionId &&
+            query.contains(previous.query, ignoreCase = true)
+        ) {
+            val complete = scan.range(last, previous.lastId + 1) &&
+                    scan.ids(previous.ids) &&
+                    scan.range(previous.firstId - 1, first)
+            if (!complete) return null
+            return SearchResult(query, minLevel, connectionId, scan.result(), first, last, searchGeneration)
+        }
+
+        if (blocks == null) {
+            if (!scan.range(last, first)) return null
+        } else {
+            for (block in blocks.sortedDescending()) {
+                val blockStart = maxOf(block shl BLOCK_SHIFT, first)
+                val blockEnd = minOf((block shl BLOCK_SHIFT) + BLOCK_SIZE - 1, last)
+                if (!scan.range(blockEnd, blockStart)) return null
+            }
+        }
+        return SearchResult(query, minLevel, connectionId, scan.result(), first, last, searchGeneration)
+    }
+
+    /** One search's matches, checked a block of ids at a time under the index monitor. */
+    private inner class Scan(
+        private val query: String,
+        private val minLevel: LogLevel?,
+        private val connectionId: Int?,
+        private val searchGeneration: Int,
+        private val isCancelled: () -> Boolean
+    ) {
+        private val matched = ArrayList<Int>()
+
+        /** Checks ids [high] down to [low]; false if cancelled or the index was cleared. */
+        fun range(high: Int, low: Int): Boolean {
+            var id = high
+            while (id >= low) {
+                if (isCancelled()) return false
+                val chunkEnd = maxOf(low, id - BLOCK_SIZE + 1)
+                synchronized(this@LogSearchIndex) {
+                    if (generation != searchGeneration) return false
+                    while (id >= chunkEnd) {
+                        if (matches(id, query, minLevel, connectionId)) matched.add(id)
+                        id--
+                    }
+                }
+            }
+            return true
+        }
+
+        fun ids(ids: IntArray): Boolean {
+            var index = 0
+            while (index < ids.size) {
+                if (isCancelled()) return false
+                val chunkEnd = minOf(ids.size, index + BLOCK_SIZE)
+                synchronized(this@LogSearchIndex) {
+                    if (generation != searchGeneration) return false
+                    while (index < chunkEnd) {
+                        val id = ids[index++]
+                        if (matches(id, query, minLevel, connectionId)) matched.add(id)
+                    }
+                }
+            }
+            return true
+        }
+
+        fun result(): IntArray = matched.toIntArray()
+    }
+
+    private fun matches(id: Int, query: String, minLevel: LogLevel?, connectionId: Int?): Boolean {
+        if (connectionId != null) {
+            val recordConnection = if (id >= 0) newer.connectionId(id) else older.connectionId(-id - 1)
+            if (recordConnection != connectionId) return false
+        }
+        if (minLevel != null) {
+            val level = level(id)
+            if (level == LogLevel.Unknown || level < minLevel) return false
+        }
+        return query.isEmpty() || line(id).contains(query, ignoreCase = true)
+    }
+
+    private fun candidateBlocks(query: String): IntArray? {
+        if (query.length < 3) return null
+        var best: BlockList? = null
+        for (i in 0..query.length - 3) {
+            val list = postings[trigramKey(query, i)] ?: return IntArray(0)
+            if (best == null || list.size < best.size) best = list
+        }
+        return best?.toIntArray()
+    }
+
+    private fun indexLine(id: Int, line: String) {
+        if (line.length < 3) return
+        val block = id shr BLOCK_SHIFT
+        for (i in 0..line.length - 3) {
+            postings.getOrPut(trigramKey(line, i)) { BlockList() }.add(block)
+        }
+    }
+
+    /**
+     * Folds case per char the way `contains(ignoreCase = true)` compares, so a line that passes
+     * [matches] always shares its query's trigrams. `String.lowercase` can change the length,
+     * e.g. for 'İ', and would shift every trigram after such a char.
+     */
+    private fun trigramKey(text: String, start: Int): Long =
+        (fold(text[start]).code.toLong() shl 32) or
+                (fold(text[start + 1]).code.toLong() shl 16) or
+                fold(text[start + 2]).code.toLong()
+
+    private fun fold(c: Char): Char = c.uppercaseChar().lowercaseChar()
+
+    /**
+     * Read-only window onto the index that formats a line only when it is fetched, so a list
+     * holding thousands of lines costs nothing until rows are drawn. Equality is by identity;
+     * comparing contents would format every line. Lines cleared out from under the view read as
+     * empty until the next view replaces it.
+     */
+    private inner class LineView(
+        private val ids: IntArray?,
+        override val size: Int,
+        private val newestId: Int,
+        private val viewGeneration: Int
+    ) : AbstractList<String>() {
+        override fun get(index: Int): String {
+            if (index !in 0 until size) throw IndexOutOfBoundsException("$index of $size")
+            return lineIfCurrent(viewGeneration, ids?.get(index) ?: (newestId - index))
+        }
+
+        override fun equals(other: Any?): Boolean = this === other
+
+        override fun hashCode(): Int = System.identityHashCode(this)
+    }
+
+    /**
+     * Growable list of block ids. Lines are always indexed in runs of consecutive ids, so a block
+     * is only added when it differs from the most recent one.
+     */
+    private class BlockList {
+        private var blocks = IntArray(4)
+        var size = 0
+            private set
+
+        fun add(block: Int) {
+            if (size > 0 && blocks[size - 1] == block) return
+            if (size == blocks.size) blocks = blocks.copyOf(size * 2)
+            blocks[size++] = block
+        }
+
+        fun toIntArray(): IntArray = blocks.copyOf(size).distinct().toIntArray()
+    }
+
+    companion object {
+        /**
+         * Finds Xray's `[connection id]` token among the leading bracketed tokens of [line],
+         * in the same signed form the stored records use.
+         */
+        fun parseConnectionId(line: String): Int? {
+            var open = line.indexOf('[')
+            while (open in 0..MAX_CONNECTION_PREFIX_LENGTH) {
+                val close = line.indexOf(']', open + 1)
+                if (close < 0) return null
+                val token = line.substring(open + 1, close)
+                if (token.length in 1..MAX_CONNECTION_ID_DIGITS && token[0] != '0' &&
+                    token.all { it in '0'..'9' }
+                ) {
+                    return token.toLong().takeIf { it <= UInt.MAX_VALUE.toLong() }?.toInt()
+                }
+                open = line.indexOf('[', close + 1)
+            }
+            return null
+        }
+
+        private const val MAX_CONNECTION_PREFIX_LENGTH = 48
+        private const val MAX_CONNECTION_ID_DIGITS = 10
+        private const val BLOCK_SHIFT = 6
+        private const val BLOCK_SIZE = 1 shl BLOCK_SHIFT
+    }
+}
@@ -0,0 +1,227 @@
+package com.simplexray.an.data.source
+
+import java.io.BufferedInputStream
+import java.io.ByteArrayOutputStream
+import java.io.DataInputStream
+import java.io.DataOutputStream
+import java.io.EOFException
+import java.io.File
+import java.io.FileInputStream
+import java.io.IOException
+import java.io.InputStream
+import java.io.OutputStream
+import java.util.zip.CRC32
+import java.util.zip.DeflaterOutputStream
+import java.util.zip.InflaterInputStream
+
+/**
+ * Streaming backup format: a magic header followed by entries, each a small header (type, name,
+ * uncompressed size and CRC32) and its deflated content split into length-prefixed chunks. The
+ * checksum comes before the data so a restore can compare it against the file on disk and skip
+ * the entry without inflating it, and chunks let a reader skip or copy an entry without knowing
+ * its compressed size up front. Neither side ever holds more than one chunk in memory.
+ */
+object BackupArchive {
+    const val TYPE_PREFERENCES = 1
+    const val TYPE_CONFIG_FILE = 2
+    private const val TYPE_END = 0
+
+    private val MAGIC = byteArrayOf('S'.code.toByte(), 'X'.code.toByte(), 'B'.code.toByte(), 1)
+    private const val CHUNK_SIZE = 65536
+    private const val MAX_BYTES_ENTRY_SIZE = 4L * 1024 * 1024
+
+    class Entry(val type: Int, val name: String, val size: Long, val crc: Long)
+
+    class Writer(output: OutputStream) {
+        private val output = DataOutputStream(output)
+
+        init {
+            this.output.write(MAGIC)
+        }
+
+        /** Writes an entry whose content [write] produces; [size] and [crc] must describe it. */
+        fun writeEntry(type: Int, name: String, size: Long, crc: Long, write: (OutputStream) -> Unit) {
+            output.writeByte(type)
+            output.writeUTF(name)
+            output.writeLong(size)
+            output.writeInt(crc.toInt())
+            val chunks = ChunkedOutputStream(output)
+            DeflaterOutputStream(chunks).use { write(it) }
+        }
+
+        fun writeFile(type: Int, file: File) {
+            val (size, crc) = checksum(file)
+            writeEntry(type, file.name, size, crc) { out ->
+                FileInputStream(file).use { it.copyTo(out, CHUNK_SIZE) }
+            }
+        }
+
+        fun finish() {
+            output.writeByte(TYPE_END)
+            output.flush()
+        }
+    }
+
+    class Reader(input: InputStream) {
+        private val input = DataInputStream(input)
+        private var pending: ChunkedInputStream? = null
+
+        /** The next entry, skipping whatever of the previous one wasn't read; null at the end. */
+        fun nextEntry(): Entry? {
+            pending?.skipRemaining()
+            pending = null
+            val type = input.readUnsignedByte()
+            if (type == TYPE_END) return null
+            val entry = Entry(
+                type,
+                input.readUTF(),
+                input.readLong(),
+                input.readInt().toLong() and 0xffffffffL
+            )
+            pending = ChunkedInputStream(input)
+            return entry
+        }
+
+        /** Inflates the current entry into [output], failing if it doesn't match its checksum. */
+        fun copyEntry(entry: Entry, output: OutputStream) {
+            val chunks = pending ?: throw IllegalStateException("No current entry")
+            val crc = CRC32()
+            var size = 0L
+            InflaterInputStream(chunks).use { inflater ->
+                val buffer = ByteArray(CHUNK_SIZE)
+                while (true) {
+                    val count = inflater.read(buffer)
+                    if (count < 0) break
+                    crc.update(buffer, 0, count)
+                    size += count
+                    if (size > entry.size) break
+                    output.write(buffer, 0, count)
+                }
+            }
+            if (size != entry.size || crc.value != entry.crc) {
+                throw IOException("Checksum mismatch in backup entry ${entry.name}")
+            }
+        }
+
+        /** For small entries like the preferences; sizes above [MAX_BYTES_ENTRY_SIZE] are refused. */
+        fun readEntryBytes(entry: Entry): ByteArray {
+            if (entry.size !in 0..MAX_BYTES_ENTRY_SIZE) {
+                throw IOException("Backup entry ${entry.name} is too large: ${entry.size} bytes")
+            }
+            val output = ByteArrayOutputStream(entry.size.toInt())
+            copyEntry(entry, output)
+            return output.toByteArray()
+        }
+    }
+
+    /** True if [input] starts with this format; leaves the stream where it was. */
+    fun isArchive(input: BufferedInputStream): Boolean {
+        input.mark(MAGIC.size)
+        val header = ByteArray(MAGIC.size)
+        val read = input.readNBytesCompat(header)
+        input.reset()
+        return read == MAGIC.size && header.contentEquals(MAGIC)
+    }
+
+    /** Size and CRC32 of [file], read in chunks. */
+    fun checksum(file: File): Pair<Long, Long> {
+        val crc = CRC32()
+        var size = 0L
+        FileInputStream(file).use { input ->
+            val buffer = ByteArray(CHUNK_SIZE)
+            while (true) {
+                val count = input.read(buffer)
+                if (count < 0) break
+                crc.update(buffer, 0, count)
+                size += count
+            }
+        }
+        return size to crc.value
+    }
+
+    fun checksum(bytes: ByteArray): Long = CRC32().apply { update(bytes) }.value
+
+    private fun InputStream.readNBytesCompat(buffer: ByteArray): Int {
+        var total = 0
+        while (total < buffer.size) {
+            val count = read(buffer, total, buffer.size - total)
+            if (count < 0) break
+            total += count
+        }
+        return total
+    }
+
+    private class ChunkedOutputStream(private val output: DataOutputStream) : OutputStream() {
+        private val buffer = ByteArray(CHUNK_SIZE)
+        private var count = 0
+
+        override fun write(b: Int) {
+            if (count == buffer.size) flushChunk()
+            buffer[count++] = b.toByte()
+        }
+
+        override fun write(b: ByteArray, off: Int, len: Int) {
+            var offset = off
+            var remaining = len
+            while (remaining > 0) {
+                if (count == buffer.size) flushChunk()
+                val n = minOf(remaining, buffer.size - count)
+                System.arraycopy(b, offset, buffer, count, n)
+                count += n
+                offset += n
+                remaining -= n
+            }
+        }
+
+        private fun flushChunk() {
+            if (count == 0) return
+            output.writeInt(count)
+            output.write(buffer, 0, count)
+            count = 0
+        }
+
+        /** Ends the entry; the underlying stream stays open for the next one. */
+        override fun close() {
+            flushChunk()
+            output.writeInt(0)
+        }
+    }
+
+    private class ChunkedInputStream(private val input: DataInputStream) : InputStream() {
+        private var remaining = 0
+        private var finished = false
+
+        private fun nextChunk(): Boolean {
+            while (remaining == 0) {
+                if (finished) return false
+                val length = input.readInt()
+                if (length < 0 || length > CHUNK_SIZE) throw IOException("Corrupt backup chunk")
+                if (length == 0) finished = true else remaining = length
+            }
+            return true
+        }
+
+        override fun read(): Int {
+            if (!nextChunk()) return -1
+            remaining--
+            return input.read().also { if (it < 0) throw EOFException() }
+        }
+
+        override fun read(b: ByteArray, off: Int, len: Int): Int {
+            if (len == 0) return 0
+            if (!nextChunk()) return -1
+            val count = input.read(b, off, minOf(len, remaining))
+            if (count < 0) throw EOFException()
+            remaining -= count
+            return count
+        }
+
+        fun skipRemaining() {
+            while (nextChunk()) {
+                val skipped = input.skipBytes(remaining)
+                if (skipped <= 0) throw EOFException()
+                remaining -= skipped
+            }
+        }
+    }
+}
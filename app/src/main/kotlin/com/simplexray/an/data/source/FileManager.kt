@@ -4,6 +4,7 @@ import android.app.Application
 import android.content.ClipData
 import android.content.ClipboardManager
 import android.content.Context
+import android.content.pm.PackageManager
 import android.content.res.AssetManager
 import android.net.Uri
 import android.util.Log
@@ -17,23 +18,21 @@ import com.simplexray.an.prefs.Preferences
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
 import org.json.JSONException
-import java.io.ByteArrayOutputStream
+import java.io.BufferedInputStream
+import java.io.BufferedOutputStream
 import java.io.File
+import java.io.FileNotFoundException
 import java.io.FileOutputStream
 import java.io.IOException
 import java.io.InputStream
 import java.net.URLDecoder
 import java.nio.charset.StandardCharsets
-import java.nio.file.Files
-import java.security.MessageDigest
-import java.security.NoSuchAlgorithmException
 import java.text.SimpleDateFormat
 import java.util.Base64
 import java.util.Date
 import java.util.Locale
-import java.util.zip.DataFormatException
-import java.util.zip.Deflater
-import java.util.zip.Inflater
+import java.util.zip.InflaterInputStream
+import java.util.zip.ZipException
 import kotlin.math.log10
 import kotlin.math.pow
 
@@ -43,23 +42,58 @@ class FileManager(private val application: Application, private val prefs: Prefe
         return file.readText(StandardCharsets.UTF_8)
     }
 
-    @Throws(IOException::class, NoSuchAlgorithmException::class)
-    private fun calculateSha256(`is`: InputStream): String {
-        val digest = MessageDigest.getInstance("SHA-256")
-        val buffer = ByteArray(1024)
-        var read: Int
-        `is`.use { inputStream ->
-            while ((inputStream.read(buffer).also { read = it }) != -1) {
-                digest.update(buffer, 0, read)
-            }
+    private val ruleFileManifest: RuleFileManifest
+        get() = getRuleFileManifest(application)
+
+    /**
+     * Bundled assets only change when the APK does, so the install time identifies them without
+     * reading a byte.
+     */
+    private fun assetSource(): String {
+        val lastUpdateTime = try {
+            application.packageManager.getPackageInfo(application.packageName, 0).lastUpdateTime
+        } catch (e: PackageManager.NameNotFoundException) {
+            0
         }
+        return "asset:$lastUpdateTime"
+    }
 
-        val hashBytes = digest.digest()
-        val sb = StringBuilder()
-        for (hashByte in hashBytes) {
-            sb.append(String.format("%02x", hashByte))
+    /**
+     * Copies asset [name] to [target] through a temp file. Uncompressed assets are moved with
+     * channel transfers, which the kernel serves without copying through user space; compressed
+     * ones fall back to a large-buffer stream copy.
+     */
+    @Throws(IOException::class)
+    private fun extractAsset(name: String, target: File) {
+        val tempFile = File(target.path + ".tmp")
+        try {
+            try {
+                val descriptor = application.assets.openFd(name)
+                descriptor.createInputStream().use { input ->
+                    FileOutputStream(tempFile).use { output ->
+                        val inChannel = input.channel
+                        val outChannel = output.channel
+                        var position = 0L
+                        val length = descriptor.length
+                        while (position < length) {
+                            val transferred = inChannel.transferTo(
+                                descriptor.startOffset + position, length - position, outChannel
+                            )
+                            if (transferred <= 0) throw IOException("Short transfer for $name")
+                            position += transferred
+                        }
+                    }
+                }
+            } catch (e: FileNotFoundException) {
+                application.assets.open(name).use { input ->
+                    FileOutputStream(tempFile).use { input.copyTo(it, COPY_BUFFER_SIZE) }
+                }
+            }
+            if (!tempFile.renameTo(target)) throw IOException("Failed to replace $target")
+        } catch (e: IOException) {
+            tempFile.delete()
+            throw e
         }
-        return sb.toString()
     }
 
     private fun getClipboardContent(context: Context): String? {
@@ -165,332 +199,473 @@ class FileManager(private val application: Application, private val prefs: Prefe
         }
     }
 
-    suspend fun compressBackupData(): ByteArray? {
+    private fun backupPreferences(): Map<String, Any> {
+        val preferencesMap: MutableMap<String, Any> = mutableMapOf()
+        preferencesMap[Preferences.SOCKS_ADDR] = prefs.socksAddress
+        preferencesMap[Preferences.SOCKS_PORT] = prefs.socksPort
+        preferencesMap[Preferences.DNS_IPV4] = prefs.dnsIpv4
+        preferencesMap[Preferences.DNS_IPV6] = prefs.dnsIpv6
+        preferencesMap[Preferences.IPV6] = prefs.ipv6
+        preferencesMap[Preferences.APPS] = ArrayList(
+            prefs.apps ?: emptySet()
+        )
+        preferencesMap[Preferences.BYPASS_LAN] = prefs.bypassLan
+        preferencesMap[Preferences.SOCKS_PIPELINE] = prefs.socksPipeline
+        preferencesMap[Preferences.UDP_IN_TCP] = prefs.udpInTcp
+        preferencesMap[Preferences.UDP_RECV_BUFFER_SIZE] = prefs.udpRecvBufferSize
+        preferencesMap[Preferences.UDP_COPY_BUFFER_NUMS] = prefs.udpCopyBufferNums
+        preferencesMap[Preferences.TCP_BUFFER_SIZE] = prefs.tcpBufferSize
+        preferencesMap[Preferences.TCP_IDLE_TIMEOUT] = prefs.tcpIdleTimeout
+        preferencesMap[Preferences.UDP_IDLE_TIMEOUT] = prefs.udpIdleTimeout
+        preferencesMap[Preferences.MAP_DNS] = prefs.mapDns
+        preferencesMap[Preferences.MAP_DNS_CACHE_SIZE] = prefs.mapDnsCacheSize
+        preferencesMap[Preferences.USE_TEMPLATE] = prefs.useTemplate
+        preferencesMap[Preferences.HTTP_PROXY_ENABLED] = prefs.httpProxyEnabled
+        preferencesMap[Preferences.CONFIG_FILES_ORDER] = prefs.configFilesOrder
+        preferencesMap[Preferences.DISABLE_VPN] = prefs.disableVpn
+        preferencesMap[Preferences.AUTO_SELECT_CONFIG] = prefs.autoSelectConfig
+        preferencesMap[Preferences.CONNECTIVITY_TEST_TARGET] = prefs.connectivityTestTarget
+        preferencesMap[Preferences.CONNECTIVITY_TEST_TIMEOUT] =
+            prefs.connectivityTestTimeout
+        preferencesMap[Preferences.GEOIP_URL] = prefs.geoipUrl
+        preferencesMap[Preferences.GEOSITE_URL] = prefs.geositeUrl
+        preferencesMap[Preferences.BYPASS_SELECTED_APPS] = prefs.bypassSelectedApps
+        preferencesMap[Preferences.TUNNEL_MTU] = prefs.tunnelMtu
+        return preferencesMap
+    }
+
+    /**
+     * Streams a backup to [uri] as a [BackupArchive]: the preferences, then every config file,
+     * each compressed on its own as it is written.
+     */
+    suspend fun writeBackup(uri: Uri): Boolean {
         return withContext(Dispatchers.IO) {
             try {
-                val gson = Gson()
-                val preferencesMap: MutableMap<String, Any> = mutableMapOf()
-                preferencesMap[Preferences.SOCKS_ADDR] = prefs.socksAddress
-                preferencesMap[Preferences.SOCKS_PORT] = prefs.socksPort
-                preferencesMap[Preferences.DNS_IPV4] = prefs.dnsIpv4
-                preferencesMap[Preferences.DNS_IPV6] = prefs.dnsIpv6
-                preferencesMap[Preferences.IPV6] = prefs.ipv6
-                preferencesMap[Preferences.APPS] = ArrayList(
-                    prefs.apps ?: emptySet()
-                )
-                preferencesMap[Preferences.BYPASS_LAN] = prefs.bypassLan
-                preferencesMap[Preferences.USE_TEMPLATE] = prefs.useTemplate
-                preferencesMap[Preferences.HTTP_PROXY_ENABLED] = prefs.httpProxyEnabled
-                preferencesMap[Preferences.CONFIG_FILES_ORDER] = prefs.configFilesOrder
-                preferencesMap[Preferences.DISABLE_VPN] = prefs.disableVpn
-                preferencesMap[Preferences.CONNECTIVITY_TEST_TARGET] = prefs.connectivityTestTarget
-                preferencesMap[Preferences.CONNECTIVITY_TEST_TIMEOUT] =
-                    prefs.connectivityTestTimeout
-                preferencesMap[Preferences.GEOIP_URL] = prefs.geoipUrl
-                preferencesMap[Preferences.GEOSITE_URL] = prefs.geositeUrl
-                preferencesMap[Preferences.BYPASS_SELECTED_APPS] = prefs.bypassSelectedApps
-                val configFilesMap: MutableMap<String, String> = mutableMapOf()
-                val filesDir = application.filesDir
-                val files = filesDir.listFiles()
-                if (files != null) {
-                    for (file in files) {
-                        if (file.isFile && file.name.endsWith(".json")) {
+                application.contentResolver.openOutputStream(uri).use { os ->
+                    if (os == null) {
+                        throw IOException("Failed to open output stream for URI: $uri")
+                    }
+                    val writer = BackupArchive.Writer(BufferedOutputStream(os, COPY_BUFFER_SIZE))
+                    val preferences = Gson().toJson(backupPreferences())
+                        .toByteArray(StandardCharsets.UTF_8)
+                    writer.writeEntry(
+                        BackupArchive.TYPE_PREFERENCES,
+                        PREFERENCES_ENTRY,
+                        preferences.size.toLong(),
+                        BackupArchive.checksum(preferences)
+                    ) { it.write(preferences) }
+                    application.filesDir.listFiles()
+                        ?.filter { it.isFile && it.name.endsWith(".json") }
+                        ?.forEach { file ->
                             try {
-                                val content = readFileContent(file)
-                                configFilesMap[file.name] = content
-                            } catch (e: IOException) {
-                                Log.e(TAG, "Error reading config file: ${file.name}", e)
+                                writer.writeFile(BackupArchive.TYPE_CONFIG_FILE, file)
+                            } catch (e: FileNotFoundException) {
+                                Log.e(TAG, "Config file vanished during backup: ${file.name}", e)
                             }
                         }
-                    }
-                }
-                val backupData: MutableMap<String, Any> = mutableMapOf()
-                backupData["preferences"] = preferencesMap
-                backupData["configFiles"] = configFilesMap
-                val jsonString = gson.toJson(backupData)
-                val input = jsonString.toByteArray(StandardCharsets.UTF_8)
-                val deflater = Deflater()
-                deflater.setInput(input)
-                deflater.finish()
-                val outputStream = ByteArrayOutputStream(input.size)
-                val buffer = ByteArray(1024)
-                while (!deflater.finished()) {
-                    val count = deflater.deflate(buffer)
-                    outputStream.write(buffer, 0, count)
+                    writer.finish()
                 }
-                outputStream.close()
-                deflater.end()
-                outputStream.toByteArray()
+                true
             } catch (e: Exception) {
-                Log.e(TAG, "Error during backup compression", e)
-                null
+                Log.e(TAG, "Error during backup", e)
+                false
             }
         }
     }
 
+    /**
+     * Restores a backup written by [writeBackup], or the older single-deflate JSON format. Config
+     * files that already match their entry's checksum are left alone.
+     */
     suspend fun decompressAndRestore(uri: Uri): Boolean {
         return withContext(Dispatchers.IO) {
             try {
-                var compressedData: ByteArray
                 application.contentResolver.openInputStream(uri).use { `is` ->
                     if (`is` == null) {
                         throw IOException("Failed to open input stream for URI: $uri")
                     }
-                    val buffer = ByteArrayOutputStream()
-                    var nRead: Int
-                    val data = ByteArray(1024)
-                    while ((`is`.read(data, 0, data.size).also { nRead = it }) != -1) {
-                        buffer.write(data, 0, nRead)
+                    val input = BufferedInputStream(`is`, COPY_BUFFER_SIZE)
+                    val savedOrderFromBackup = if (BackupArchive.isArchive(input)) {
+                        restoreArchive(input)
+                    } else {
+                        restoreLegacyBackup(input)
                     }
-                    compressedData = buffer.toByteArray()
+                    restoreConfigFilesOrder(savedOrderFromBackup)
                 }
-                val inflater = Inflater()
-                inflater.setInput(compressedData)
-                val outputStream = ByteArrayOutputStream(compressedData.size)
-                val buffer = ByteArray(1024)
-                while (!inflater.finished()) {
-                    try {
-                        val count = inflater.inflate(buffer)
-                        if (count == 0 && inflater.needsInput()) {
-                            Log.e(TAG, "Incomplete compressed data during inflation.")
-                            throw IOException("Incomplete compressed data.")
+                Log.d(TAG, "Restore successful.")
+                true
+            } catch (e: Exception) {
+                Log.e(TAG, "Error during restore process", e)
+                false
+            }
+        }
+    }
+
+    private fun restoreArchive(input: InputStream): List<String> {
+        val reader = BackupArchive.Reader(input)
+        val filesDir = application.filesDir
+        var preferencesMap: Map<String?, Any?>? = null
+        var unchanged = 0
+        // Verified configs wait in temp files, keyed by target, until the whole archive has
+        // checked out; a bad entry anywhere then leaves every existing config untouched.
+        val pending = LinkedHashMap<File, File>()
+        try {
+            while (true) {
+                val entry = reader.nextEntry() ?: break
+                when (entry.type) {
+                    BackupArchive.TYPE_PREFERENCES -> {
+                        val json = String(reader.readEntryBytes(entry), StandardCharsets.UTF_8)
+                        val type = object : TypeToken<Map<String?, Any?>?>() {}.type
+                        preferencesMap = Gson().fromJson<Map<String?, Any?>>(json, type)
+                    }
+
+                    BackupArchive.TYPE_CONFIG_FILE -> {
+                        if (FilenameValidator.validateFilename(application, entry.name) != null) {
+                            Log.e(TAG, "Skipping restore of invalid filename: ${entry.name}")
+                            continue
                         }
-                        if (count > 0) {
-                            outputStream.write(buffer, 0, count)
+                        val configFile = File(filesDir, entry.name)
+                        pending.remove(configFile)?.delete()
+                        if (configFile.isFile && configFile.length() == entry.size &&
+                            BackupArchive.checksum(configFile).second == entry.crc
+                        ) {
+                            unchanged++
+                            continue
                         }
-                    } catch (e: DataFormatException) {
-                        Log.e(TAG, "Data format error during inflation", e)
-                        throw IOException("Error decompressing data: Invalid format.", e)
-                    } catch (e: Exception) {
-                        Log.e(TAG, "Error during inflation", e)
-                        throw IOException("Error decompressing data.", e)
+                        val tempFile = File(filesDir, entry.name + ".restore")
+                        pending[configFile] = tempFile
+                        FileOutputStream(tempFile).use { reader.copyEntry(entry, it) }
                     }
+
+                    else -> Log.w(TAG, "Skipping unknown backup entry type ${entry.type}")
                 }
-                outputStream.close()
-                val decompressedData = outputStream.toByteArray()
-                inflater.end()
-
-                val jsonString = String(decompressedData, StandardCharsets.UTF_8)
-                val gson = Gson()
-                val backupDataType = object : TypeToken<Map<String?, Any?>?>() {}.type
-                val backupData = gson.fromJson<Map<String, Any>>(jsonString, backupDataType)
-
-                require(
-                    !(backupData == null || !backupData.containsKey("preferences") || !backupData.containsKey(
-                        "configFiles"
-                    ))
-                ) { "Invalid backup file format." }
-
-                var preferencesMap: Map<String?, Any?>? = null
-                val preferencesObj = backupData["preferences"]
-                if (preferencesObj is Map<*, *>) {
-                    @Suppress("UNCHECKED_CAST")
-                    preferencesMap = preferencesObj as Map<String?, Any?>?
+            }
+            for ((configFile, tempFile) in pending) {
+                if (!tempFile.renameTo(configFile)) {
+                    throw IOException("Failed to replace ${configFile.name}")
                 }
+            }
+        } finally {
+            pending.values.forEach { it.delete() }
+        }
+        Log.d(TAG, "Restored ${pending.size} config files, $unchanged unchanged")
+        return preferencesMap?.let { restorePreferences(it) } ?: emptyList()
+    }
 
-                var configFilesMap: Map<String?, String>? = null
-                val configFilesObj = backupData["configFiles"]
-                if (configFilesObj is Map<*, *>) {
-                    @Suppress("UNCHECKED_CAST")
-                    configFilesMap = configFilesObj as Map<String?, String>?
-                }
+    private fun restoreLegacyBackup(input: InputStream): List<String> {
+        val jsonString = try {
+            InflaterInputStream(input).bufferedReader(StandardCharsets.UTF_8).use { it.readText() }
+        } catch (e: ZipException) {
+            throw IOException("Error decompressing data: Invalid format.", e)
+        }
+        val gson = Gson()
+        val backupDataType = object : TypeToken<Map<String?, Any?>?>() {}.type
+        val backupData = gson.fromJson<Map<String, Any>>(jsonString, backupDataType)
+
+        require(
+            !(backupData == null || !backupData.containsKey("preferences") || !backupData.containsKey(
+                "configFiles"
+            ))
+        ) { "Invalid backup file format." }
+
+        var preferencesMap: Map<String?, Any?>? = null
+        val preferencesObj = backupData["preferences"]
+        if (preferencesObj is Map<*, *>) {
+            @Suppress("UNCHECKED_CAST")
+            preferencesMap = preferencesObj as Map<String?, Any?>?
+        }
 
-                val savedOrderFromBackup = mutableListOf<String>()
-
-                if (preferencesMap != null) {
-                    var value = preferencesMap[Preferences.SOCKS_PORT]
-                    if (value is Number) {
-                        prefs.socksPort = value.toInt()
-                    } else if (value is String) {
-                        try {
-                            prefs.socksPort = value.toInt()
-                        } catch (ignore: NumberFormatException) {
-                            Log.w(TAG, "Failed to parse SOCKS_PORT as integer: $value")
-                        }
-                    }
+        var configFilesMap: Map<String?, String>? = null
+        val configFilesObj = backupData["configFiles"]
+        if (configFilesObj is Map<*, *>) {
+            @Suppress("UNCHECKED_CAST")
+            configFilesMap = configFilesObj as Map<String?, String>?
+        }
 
-                    value = preferencesMap[Preferences.DNS_IPV4]
-                    if (value is String) {
-                        prefs.dnsIpv4 = (value as String?)!!
-                    }
+        val savedOrderFromBackup = if (preferencesMap != null) {
+            restorePreferences(preferencesMap)
+        } else {
+            Log.w(TAG, "Preferences map is null or not a Map.")
+            emptyList()
+        }
 
-                    value = preferencesMap[Preferences.DNS_IPV6]
-                    if (value is String) {
-                        prefs.dnsIpv6 = (value as String?)!!
+        val filesDir = application.filesDir
+
+        if (configFilesMap != null) {
+            for ((filename, content) in configFilesMap) {
+                if (filename == null || FilenameValidator.validateFilename(
+                        application,
+                        filename
+                    ) != null
+                ) {
+                    Log.e(TAG, "Skipping restore of invalid filename: $filename")
+                    continue
+                }
+                val configFile = File(filesDir, filename)
+                try {
+                    FileOutputStream(configFile).use { fos ->
+                        fos.write(content.toByteArray(StandardCharsets.UTF_8))
+                        Log.d(TAG, "Successfully restored/overwrote config file: $filename")
                     }
+                } catch (e: IOException) {
+                    Log.e(TAG, "Error writing config file: $filename", e)
+                }
+            }
+        } else {
+            Log.w(TAG, "Config files map is null or not a Map.")
+        }
 
-                    value = preferencesMap[Preferences.IPV6]
-                    if (value is Boolean) {
-                        prefs.ipv6 = (value as Boolean?)!!
-                    }
+        return savedOrderFromBackup
+    }
 
-                    value = preferencesMap[Preferences.BYPASS_LAN]
-                    if (value is Boolean) {
-                        prefs.bypassLan = (value as Boolean?)!!
-                    }
+    /** Applies backed-up preferences and returns the config order they carried. */
+    private fun restorePreferences(preferencesMap: Map<String?, Any?>): List<String> {
+        val savedOrderFromBackup = mutableListOf<String>()
 
-                    value = preferencesMap[Preferences.USE_TEMPLATE]
-                    if (value is Boolean) {
-                        prefs.useTemplate = (value as Boolean?)!!
-                    }
+        var value = preferencesMap[Preferences.SOCKS_PORT]
+        if (value is Number) {
+            prefs.socksPort = value.toInt()
+        } else if (value is String) {
+            try {
+                prefs.socksPort = value.toInt()
+            } catch (ignore: NumberFormatException) {
+                Log.w(TAG, "Failed to parse SOCKS_PORT as integer: $value")
+            }
+        }
 
-                    value = preferencesMap[Preferences.HTTP_PROXY_ENABLED]
-                    if (value is Boolean) {
-                        prefs.httpProxyEnabled = (value as Boolean?)!!
-                    }
+        value = preferencesMap[Preferences.DNS_IPV4]
+        if (value is String) {
+            prefs.dnsIpv4 = (value as String?)!!
+        }
 
-                    value = preferencesMap[Preferences.APPS]
-                    if (value is List<*>) {
-                        val appsSet: MutableSet<String?> = HashSet()
-                        for (item in value) {
-                            if (item is String) {
-                                appsSet.add(item as String?)
-                            } else if (item != null) {
-                                Log.w(
-                                    TAG,
-                                    "Skipping non-String item in APPS list: " + item.javaClass.name
-                                )
-                            }
-                        }
-                        prefs.apps = appsSet
-                    } else if (value != null) {
-                        Log.w(TAG, "APPS preference is not a List: " + value.javaClass.name)
-                    }
+        value = preferencesMap[Preferences.DNS_IPV6]
+        if (value is String) {
+            prefs.dnsIpv6 = (value as String?)!!
+        }
 
-                    value = preferencesMap[Preferences.DISABLE_VPN]
-                    if (value is Boolean) {
-                        prefs.disableVpn = value
-                    }
+        value = preferencesMap[Preferences.IPV6]
+        if (value is Boolean) {
+            prefs.ipv6 = (value as Boolean?)!!
+        }
 
-                    value = preferencesMap[Preferences.CONNECTIVITY_TEST_TARGET]
-                    if (value is String) {
-                        prefs.connectivityTestTarget = value
-                    }
-                    value = preferencesMap[Preferences.CONNECTIVITY_TEST_TIMEOUT]
-                    if (value is Number) {
-                        prefs.connectivityTestTimeout = value.toInt()
-                    } else if (value is String) {
-                        try {
-                            prefs.connectivityTestTimeout = value.toInt()
-                        } catch (ignore: NumberFormatException) {
-                            Log.w(
-                                TAG,
-                                "Failed to parse CONNECTIVITY_TEST_TIMEOUT as integer: $value"
-                            )
-                        }
-                    }
+        value = preferencesMap[Preferences.BYPASS_LAN]
+        if (value is Boolean) {
+            prefs.bypassLan = (value as Boolean?)!!
+        }
 
-                    value = preferencesMap[Preferences.GEOIP_URL]
-                    if (value is String) {
-                        prefs.geoipUrl = value
-                    }
+        value = preferencesMap[Preferences.SOCKS_PIPELINE]
+        if (value is Boolean) {
+            prefs.socksPipeline = value
+        }
 
-                    value = preferencesMap[Preferences.GEOSITE_URL]
-                    if (value is String) {
-                        prefs.geositeUrl = value
-                    }
+        value = preferencesMap[Preferences.UDP_IN_TCP]
+        if (value is Boolean) {
+            prefs.udpInTcp = value
+        }
 
-                    value = preferencesMap[Preferences.BYPASS_SELECTED_APPS]
-                    if (value is Boolean) {
-                        prefs.bypassSelectedApps = value
-                    }
+        value = preferencesMap[Preferences.UDP_RECV_BUFFER_SIZE]
+        if (value is Number) {
+            prefs.udpRecvBufferSize = value.toInt()
+        } else if (value is String) {
+            try {
+                prefs.udpRecvBufferSize = value.toInt()
+            } catch (ignore: NumberFormatException) {
+                Log.w(TAG, "Failed to parse UDP_RECV_BUFFER_SIZE as integer: $value")
+            }
+        }
 
-                    val configOrderObj = preferencesMap[Preferences.CONFIG_FILES_ORDER]
-                    if (configOrderObj is List<*>) {
-                        for (item in configOrderObj) {
-                            if (item is String) {
-                                savedOrderFromBackup.add(item)
-                            } else if (item != null) {
-                                Log.w(
-                                    TAG,
-                                    "Skipping non-String item in CONFIG_FILES_ORDER list: " + item.javaClass.name
-                                )
-                            }
-                        }
-                    } else if (configOrderObj != null) {
-                        Log.w(
-                            TAG,
-                            "CONFIG_FILES_ORDER preference is not a List: " + configOrderObj.javaClass.name
-                        )
-                    }
+        value = preferencesMap[Preferences.UDP_COPY_BUFFER_NUMS]
+        if (value is Number) {
+            prefs.udpCopyBufferNums = value.toInt()
+        } else if (value is String) {
+            try {
+                prefs.udpCopyBufferNums = value.toInt()
+            } catch (ignore: NumberFormatException) {
+                Log.w(TAG, "Failed to parse UDP_COPY_BUFFER_NUMS as integer: $value")
+            }
+        }
 
-                } else {
-                    Log.w(TAG, "Preferences map is null or not a Map.")
-                }
+        value = preferencesMap[Preferences.TCP_BUFFER_SIZE]
+        if (value is Number) {
+            prefs.tcpBufferSize = value.toInt()
+        } else if (value is String) {
+            try {
+                prefs.tcpBufferSize = value.toInt()
+            } catch (ignore: NumberFormatException) {
+                Log.w(TAG, "Failed to parse TCP_BUFFER_SIZE as integer: $value")
+            }
+        }
 
-                val filesDir = application.filesDir
+        value = preferencesMap[Preferences.TCP_IDLE_TIMEOUT]
+        if (value is Number) {
+            prefs.tcpIdleTimeout = value.toInt()
+        }
 
-                if (configFilesMap != null) {
-                    for ((filename, content) in configFilesMap) {
-                        if (filename == null || FilenameValidator.validateFilename(
-                                application,
-                                filename
-                            ) != null
-                        ) {
-                            Log.e(TAG, "Skipping restore of invalid filename: $filename")
-                            continue
-                        }
-                        val configFile = File(filesDir, filename)
-                        try {
-                            FileOutputStream(configFile).use { fos ->
-                                fos.write(content.toByteArray(StandardCharsets.UTF_8))
-                                Log.d(TAG, "Successfully restored/overwrote config file: $filename")
-                            }
-                        } catch (e: IOException) {
-                            Log.e(TAG, "Error writing config file: $filename", e)
-                        }
-                    }
-                } else {
-                    Log.w(TAG, "Config files map is null or not a Map.")
-                }
+        value = preferencesMap[Preferences.UDP_IDLE_TIMEOUT]
+        if (value is Number) {
+            prefs.udpIdleTimeout = value.toInt()
+        }
+
+        value = preferencesMap[Preferences.MAP_DNS]
+        if (value is Boolean) {
+            prefs.mapDns = value
+        }
+
+        value = preferencesMap[Preferences.MAP_DNS_CACHE_SIZE]
+        if (value is Number) {
+            prefs.mapDnsCacheSize = value.toInt()
+        } else if (value is String) {
+            try {
+                prefs.mapDnsCacheSize = value.toInt()
+            } catch (ignore: NumberFormatException) {
+                Log.w(TAG, "Failed to parse MAP_DNS_CACHE_SIZE as integer: $value")
+            }
+        }
 
-                val existingFileNames = prefs.configFilesOrder.toMutableList()
-                val actualFileNamesAfterRestore =
-                    filesDir.listFiles { file -> file.isFile && file.name.endsWith(".json") }
-                        ?.map { it.name }?.toMutableSet() ?: mutableSetOf()
+        value = preferencesMap[Preferences.USE_TEMPLATE]
+        if (value is Boolean) {
+            prefs.useTemplate = (value as Boolean?)!!
+        }
 
-                val finalConfigOrder = mutableListOf<String>()
-                val processedFileNames = mutableSetOf<String>()
+        value = preferencesMap[Preferences.HTTP_PROXY_ENABLED]
+        if (value is Boolean) {
+            prefs.httpProxyEnabled = (value as Boolean?)!!
+        }
 
-                savedOrderFromBackup.forEach { filename ->
-                    if (actualFileNamesAfterRestore.contains(filename)) {
-                        finalConfigOrder.add(filename)
-                        processedFileNames.add(filename)
-                    }
+        value = preferencesMap[Preferences.APPS]
+        if (value is List<*>) {
+            val appsSet: MutableSet<String?> = HashSet()
+            for (item in value) {
+                if (item is String) {
+                    appsSet.add(item as String?)
+                } else if (item != null) {
+                    Log.w(
+                        TAG,
+                        "Skipping non-String item in APPS list: " + item.javaClass.name
+                    )
                 }
+            }
+            prefs.apps = appsSet
+        } else if (value != null) {
+            Log.w(TAG, "APPS preference is not a List: " + value.javaClass.name)
+        }
 
-                existingFileNames.forEach { filename ->
-                    if (actualFileNamesAfterRestore.contains(filename) && !processedFileNames.contains(
-                            filename
-                        )
-                    ) {
-                        finalConfigOrder.add(filename)
-                        processedFileNames.add(filename)
-                    }
+        value = preferencesMap[Preferences.DISABLE_VPN]
+        if (value is Boolean) {
+            prefs.disableVpn = value
+        }
+
+        value = preferencesMap[Preferences.AUTO_SELECT_CONFIG]
+        if (value is Boolean) {
+            prefs.autoSelectConfig = value
+        }
+
+        value = preferencesMap[Preferences.CONNECTIVITY_TEST_TARGET]
+        if (value is String) {
+            prefs.connectivityTestTarget = value
+        }
+        value = preferencesMap[Preferences.CONNECTIVITY_TEST_TIMEOUT]
+        if (value is Number) {
+            prefs.connectivityTestTimeout = value.toInt()
+        } else if (value is String) {
+            try {
+                prefs.connectivityTestTimeout = value.toInt()
+            } catch (ignore: NumberFormatException) {
+                Log.w(
+                    TAG,
+                    "Failed to parse CONNECTIVITY_TEST_TIMEOUT as integer: $value"
+                )
+            }
+        }
+
+        value = preferencesMap[Preferences.TUNNEL_MTU]
+        if (value is Number) {
+            prefs.tunnelMtu = value.toInt()
+        } else if (value is String) {
+            try {
+                prefs.tunnelMtu = value.toInt()
+            } catch (ignore: NumberFormatException) {
+                Log.w(TAG, "Failed to parse TUNNEL_MTU as integer: $value")
+            }
+        }
+
+        value = preferencesMap[Preferences.GEOIP_URL]
+        if (value is String) {
+            prefs.geoipUrl = value
+        }
+
+        value = preferencesMap[Preferences.GEOSITE_URL]
+        if (value is String) {
+            prefs.geositeUrl = value
+        }
+
+        value = preferencesMap[Preferences.BYPASS_SELECTED_APPS]
+        if (value is Boolean) {
+            prefs.bypassSelectedApps = value
+        }
+
+        val configOrderObj = preferencesMap[Preferences.CONFIG_FILES_ORDER]
+        if (configOrderObj is List<*>) {
+            for (item in configOrderObj) {
+                if (item is String) {
+                    savedOrderFromBackup.add(item)
+                } else if (item != null) {
+                    Log.w(
+                        TAG,
+                        "Skipping non-String item in CONFIG_FILES_ORDER list: " + item.javaClass.name
+                    )
                 }
+            }
+        } else if (configOrderObj != null) {
+            Log.w(
+                TAG,
+                "CONFIG_FILES_ORDER preference is not a List: " + configOrderObj.javaClass.name
+            )
+        }
+        return savedOrderFromBackup
+    }
 
-                val newlyAddedFileNames =
-                    actualFileNamesAfterRestore.filter { !processedFileNames.contains(it) }.sorted()
-                finalConfigOrder.addAll(newlyAddedFileNames)
+    private fun restoreConfigFilesOrder(savedOrderFromBackup: List<String>) {
+        val filesDir = application.filesDir
+        val existingFileNames = prefs.configFilesOrder.toMutableList()
+        val actualFileNamesAfterRestore =
+            filesDir.listFiles { file -> file.isFile && file.name.endsWith(".json") }
+                ?.map { it.name }?.toMutableSet() ?: mutableSetOf()
 
-                prefs.configFilesOrder = finalConfigOrder
+        val finalConfigOrder = mutableListOf<String>()
+        val processedFileNames = mutableSetOf<String>()
 
-                Log.d(TAG, "Restore successful.")
-                true
-            } catch (e: Exception) {
-                Log.e(TAG, "Error during restore process", e)
-                false
+        savedOrderFromBackup.forEach { filename ->
+            if (actualFileNamesAfterRestore.contains(filename)) {
+                finalConfigOrder.add(filename)
+                processedFileNames.add(filename)
+            }
+        }
+
+        existingFileNames.forEach { filename ->
+            if (actualFileNamesAfterRestore.contains(filename) && !processedFileNames.contains(
+                    filename
+                )
+            ) {
+                finalConfigOrder.add(filename)
+                processedFileNames.add(filename)
             }
         }
+
+        val newlyAddedFileNames =
+            actualFileNamesAfterRestore.filter { !processedFileNames.contains(it) }.sorted()
+        finalConfigOrder.addAll(newlyAddedFileNames)
+
+        prefs.configFilesOrder = finalConfigOrder
     }
 
     fun extractAssetsIfNeeded() {
         val files = arrayOf("geoip.dat", "geosite.dat")
         val dir = application.filesDir
         dir.mkdirs()
+        val source = assetSource()
         for (file in files) {
             val targetFile = File(dir, file)
-            var needsExtraction = false
 
             val isCustomImported =
                 if (file == "geoip.dat") prefs.customGeoipImported else prefs.customGeositeImported
@@ -500,44 +675,16 @@ class FileManager(private val application: Application, private val prefs: Prefe
                 continue
             }
 
-            if (targetFile.exists()) {
-                try {
-                    val existingFileHash =
-                        calculateSha256(Files.newInputStream(targetFile.toPath()))
-                    val assetHash = calculateSha256(application.assets.open(file))
-                    if (existingFileHash != assetHash) {
-                        needsExtraction = true
-                    }
-                } catch (e: IOException) {
-                    needsExtraction = true
-                    Log.d(TAG, e.toString())
-                } catch (e: NoSuchAlgorithmException) {
-                    needsExtraction = true
-                    Log.d(TAG, e.toString())
-                }
-            } else {
-                needsExtraction = true
+            if (ruleFileManifest.matches(targetFile, source)) {
+                Log.d(TAG, "Asset $file already extracted and unchanged, skipping extraction.")
+                continue
             }
-            if (needsExtraction) {
-                try {
-                    application.assets.open(file).use { `in` ->
-                        FileOutputStream(targetFile).use { out ->
-                            val buffer = ByteArray(1024)
-                            var read: Int
-                            while ((`in`.read(buffer).also { read = it }) != -1) {
-                                out.write(buffer, 0, read)
-                            }
-                            Log.d(
-                                TAG,
-                                "Extracted asset: " + file + " to " + targetFile.absolutePath
-                            )
-                        }
-                    }
-                } catch (e: IOException) {
-                    throw RuntimeException("Failed to extract asset: $file", e)
-                }
-            } else {
-                Log.d(TAG, "Asset $file already exists and matches hash, skipping extraction.")
+            try {
+                extractAsset(file, targetFile)
+                ruleFileManifest.record(targetFile, source)
+                Log.d(TAG, "Extracted asset: " + file + " to " + targetFile.absolutePath)
+            } catch (e: IOException) {
+                throw RuntimeException("Failed to extract asset: $file", e)
             }
         }
     }
@@ -551,19 +698,16 @@ class FileManager(private val application: Application, private val prefs: Prefe
                         if (inputStream == null) {
                             throw IOException("Failed to open input stream for URI: $uri")
                         }
-                        val buffer = ByteArray(1024)
-                        var read: Int
-                        while ((inputStream.read(buffer).also { read = it }) != -1) {
-                            outputStream.write(buffer, 0, read)
-                        }
+                        inputStream.copyTo(outputStream, COPY_BUFFER_SIZE)
                         when (filename) {
                             "geoip.dat" -> prefs.customGeoipImported = true
                             "geosite.dat" -> prefs.customGeositeImported = true
                         }
                         Log.d(TAG, "Successfully imported $filename from URI: $uri")
-                        true
                     }
                 }
+                ruleFileManifest.record(targetFile, IMPORTED_SOURCE)
+                true
             } catch (e: IOException) {
                 if (filename == "geoip.dat") {
                     prefs.customGeoipImported = false
@@ -584,9 +728,25 @@ class FileManager(private val application: Application, private val prefs: Prefe
         }
     }
 
+    /**
+     * Validators of the last download of [filename] from [url], or null when the file on disk
+     * isn't that download any more and must be fetched unconditionally.
+     */
+    fun ruleFileValidators(filename: String, url: String): Pair<String?, String?>? {
+        val file = File(application.filesDir, filename)
+        if (!ruleFileManifest.matches(file, RuleFileManifest.downloadSource(url))) return null
+        val etag = ruleFileManifest.etag(filename)
+        val lastModified = ruleFileManifest.lastModified(filename)
+        if (etag == null && lastModified == null) return null
+        return etag to lastModified
+    }
+
     suspend fun saveRuleFile(
         inputStream: InputStream,
         filename: String,
+        url: String? = null,
+        etag: String? = null,
+        lastModified: String? = null,
         onProgress: (Int) -> Unit
     ): Boolean {
         return withContext(Dispatchers.IO) {
@@ -594,7 +754,7 @@ class FileManager(private val application: Application, private val prefs: Prefe
             val tempFile = File(application.filesDir, "$filename.tmp")
             try {
                 FileOutputStream(tempFile).use { outputStream ->
-                    val buffer = ByteArray(4096)
+                    val buffer = ByteArray(COPY_BUFFER_SIZE)
                     var read: Int
                     while (inputStream.read(buffer).also { read = it } != -1) {
                         outputStream.write(buffer, 0, read)
@@ -607,6 +767,12 @@ class FileManager(private val application: Application, private val prefs: Prefe
                         "geoip.dat" -> prefs.customGeoipImported = true
                         "geosite.dat" -> prefs.customGeositeImported = true
                     }
+                    ruleFileManifest.record(
+                        targetFile,
+                        url?.let { RuleFileManifest.downloadSource(it) } ?: IMPORTED_SOURCE,
+                        etag,
+                        lastModified
+                    )
                     Log.d(TAG, "Successfully saved $filename from stream")
                     true
                 } else {
@@ -719,15 +885,8 @@ class FileManager(private val application: Application, private val prefs: Prefe
         return withContext(Dispatchers.IO) {
             prefs.customGeoipImported = false
             val file = File(application.filesDir, "geoip.dat")
-            application.assets.open("geoip.dat").use { input ->
-                FileOutputStream(file).use { output ->
-                    val buffer = ByteArray(1024)
-                    var read: Int
-                    while (input.read(buffer).also { read = it } != -1) {
-                        output.write(buffer, 0, read)
-                    }
-                }
-            }
+            extractAsset("geoip.dat", file)
+            ruleFileManifest.record(file, assetSource())
             true
         }
     }
@@ -736,20 +895,25 @@ class FileManager(private val application: Application, private val prefs: Prefe
         return withContext(Dispatchers.IO) {
             prefs.customGeositeImported = false
             val file = File(application.filesDir, "geosite.dat")
-            application.assets.open("geosite.dat").use { input ->
-                FileOutputStream(file).use { output ->
-                    val buffer = ByteArray(1024)
-                    var read: Int
-                    while (input.read(buffer).also { read = it } != -1) {
-                        output.write(buffer, 0, read)
-                    }
-                }
-            }
+            extractAsset("geosite.dat", file)
+            ruleFileManifest.record(file, assetSource())
             true
         }
     }
 
     companion object {
         const val TAG = "FileManager"
+        private const val COPY_BUFFER_SIZE = 256 * 1024
+        private const val IMPORTED_SOURCE = "import"
+        private const val PREFERENCES_ENTRY = "preferences.json"
+
+        @Volatile
+        private var sharedRuleFileManifest: RuleFileManifest? = null
+
+        private fun getRuleFileManifest(context: Context): RuleFileManifest =
+            sharedRuleFileManifest ?: synchronized(this) {
+                sharedRuleFileManifest
+                    ?: RuleFileManifest(context.filesDir).also { sharedRuleFileManifest = it }
+            }
     }
 }
\ No newline at end of file
@@ -2,150 +2,423 @@ package com.simplexray.an.data.source
 
 import android.content.Context
 import android.util.Log
-import java.io.BufferedReader
+import com.simplexray.an.common.ServiceTrace
+import java.io.BufferedOutputStream
+import java.io.DataOutputStream
 import java.io.File
 import java.io.FileOutputStream
-import java.io.FileReader
-import java.io.FileWriter
 import java.io.IOException
-import java.io.PrintWriter
 import java.io.RandomAccessFile
+import java.nio.ByteBuffer
+import java.nio.channels.FileChannel
+import java.util.ArrayDeque
+import java.util.Locale
+import java.util.concurrent.ConcurrentLinkedQueue
+import java.util.concurrent.atomic.AtomicBoolean
+import java.util.concurrent.atomic.AtomicInteger
+import java.util.concurrent.locks.LockSupport
 
+data class LogChunk(
+    val lines: List<String>,
+    val startOffset: Long,
+    val endOffset: Long,
+    val reset: Boolean
+)
+
+/**
+ * Append-only log split into fixed-size segments under `files/logs`. Each segment is named by the
+ * global byte offset of its first line and has a companion `.idx` holding the big-endian start
+ * offset of every line within the segment. Offsets keep growing across rotation and clearing, so a
+ * reader can tail from the last offset it saw and detect when that data has been dropped.
+ */
 class LogFileManager(context: Context) {
-    val logFile: File
+    private val logDir = File(context.filesDir, LOG_DIR_NAME)
+    private val exportFile = File(context.filesDir, EXPORT_FILE_NAME)
+
+    private val pending = ConcurrentLinkedQueue<Any>()
+    private val pendingCount = AtomicInteger()
+    private val droppedCount = AtomicInteger()
+    private val writerIdle = AtomicBoolean(false)
+
+    @Volatile
+    private var writerThread: Thread? = null
 
-    init {
-        val filesDir = context.filesDir
-        this.logFile = File(filesDir, LOG_FILE_NAME)
-        Log.d(TAG, "Log file path: " + logFile.absolutePath)
+    @Volatile
+    var onLogsWritten: (() -> Unit)? = null
+
+    private class Segment(val base: Long, val log: File, val index: File) {
+        val size: Long get() = log.length()
     }
 
-    @Synchronized
+    /**
+     * Queues [logEntry] for the background writer. Never blocks; when the writer falls more than
+     * [MAX_PENDING_ENTRIES] behind, entries are dropped and the count is logged once it catches up.
+     */
     fun appendLog(logEntry: String?) {
+        if (logEntry == null) return
+        if (pendingCount.incrementAndGet() > MAX_PENDING_ENTRIES) {
+            pendingCount.decrementAndGet()
+            droppedCount.incrementAndGet()
+            ServiceTrace.drop(ServiceTrace.DropCause.LOG_QUEUE_FULL)
+            return
+        }
+        enqueue(logEntry)
+    }
+
+    /**
+     * Reads every complete line written at or after [offset]. If that data has been rotated away
+     * or cleared, the newest [maxLinesOnReset] lines are returned instead and [LogChunk.reset] is
+     * set.
+     */
+    fun readLogsFrom(offset: Long, maxLinesOnReset: Int): LogChunk? {
+        val segments = listSegments()
+        if (segments.isEmpty()) return LogChunk(emptyList(), offset, offset, reset = false)
+        val end = segments.last().let { it.base + it.size }
+        if (offset < segments.first().base || offset > end) return readTail(maxLinesOnReset)
+        return readRange(segments, offset, end, reset = false)
+    }
+
+    /**
+     * Reads up to [maxLines] of the newest lines without touching the rest of the log, using the
+     * per-segment line index to find where they start.
+     */
+    fun readTail(maxLines: Int): LogChunk? {
+        val segments = listSegments()
+        if (segments.isEmpty()) return LogChunk(emptyList(), 0, 0, reset = true)
+        val end = segments.last().let { it.base + it.size }
+        val start = findLineStartBefore(segments, end, maxLines)
+        return readRange(segments, start, end, reset = true)
+    }
+
+    /**
+     * Reads up to [maxLines] lines that end right before [offset], for paging towards older
+     * entries. Returns an empty chunk once the oldest retained line has been reached.
+     */
+    fun readBefore(offset: Long, maxLines: Int): LogChunk? {
+        val segments = listSegments()
+        if (segments.isEmpty() || offset <= segments.first().base) {
+            return LogChunk(emptyList(), offset, offset, reset = false)
+        }
+        val start = findLineStartBefore(segments, offset, maxLines)
+        return readRange(segments, start, offset, reset = false)
+    }
+
+    /**
+     * Concatenates the retained segments into a single file suitable for sharing.
+     */
+    fun exportLogs(): File? {
+        val segments = listSegments()
+        if (segments.isEmpty()) return null
         try {
-            FileWriter(logFile, true).use { fileWriter ->
-                PrintWriter(fileWriter).use { printWriter ->
-                    if (logEntry != null) {
-                        printWriter.println(logEntry)
+            FileOutputStream(exportFile, false).channel.use { dest ->
+                for (segment in segments) {
+                    RandomAccessFile(segment.log, "r").channel.use { src ->
+                        var position = 0L
+                        val size = src.size()
+                        while (position < size) {
+                            position += src.transferTo(position, size - position, dest)
+                        }
                     }
                 }
             }
+            return exportFile
         } catch (e: IOException) {
-            Log.e(TAG, "Error appending log to file", e)
-        } finally {
-            checkAndTruncateLogFile()
+            Log.e(TAG, "Failed to export log segments", e)
+            return null
         }
     }
 
-    fun readLogs(): String? {
-        val logContent = StringBuilder()
-        if (!logFile.exists()) {
-            Log.d(TAG, "Log file does not exist.")
-            return ""
+    fun clearLogs() {
+        if (writerThread != null) {
+            enqueue(CLEAR_MARKER)
+        } else {
+            val segments = listSegments()
+            val end = segments.lastOrNull()?.let { it.base + it.size } ?: 0
+            segments.forEach { deleteSegment(it) }
+            createSegment(end)
+            Log.d(TAG, "Log segments cleared.")
         }
+    }
+
+    /**
+     * Flushes everything queued so far and stops the writer thread, waiting at most
+     * [timeoutMs] for it to finish.
+     */
+    fun close(timeoutMs: Long = 1000) {
+        val thread = writerThread ?: return
+        enqueue(STOP_MARKER)
         try {
-            FileReader(logFile).use { fileReader ->
-                BufferedReader(fileReader).use { bufferedReader ->
-                    var line: String?
-                    while (bufferedReader.readLine().also { line = it } != null) {
-                        logContent.append(line).append("\n")
-                    }
+            thread.join(timeoutMs)
+        } catch (e: InterruptedException) {
+            Thread.currentThread().interrupt()
+        }
+    }
+
+    private fun listSegments(): List<Segment> {
+        val files = logDir.listFiles() ?: return emptyList()
+        return files.asSequence()
+            .filter { it.name.endsWith(LOG_SUFFIX) }
+            .mapNotNull { file ->
+                val base = file.name.removeSuffix(LOG_SUFFIX).toLongOrNull() ?: return@mapNotNull null
+                Segment(base, file, File(logDir, segmentName(base) + INDEX_SUFFIX))
+            }
+            .sortedBy { it.base }
+            .toList()
+    }
+
+    private fun segmentName(base: Long) = String.format(Locale.ROOT, "%020d", base)
+
+    private fun createSegment(base: Long): Segment {
+        logDir.mkdirs()
+        val segment = Segment(
+            base,
+            File(logDir, segmentName(base) + LOG_SUFFIX),
+            File(logDir, segmentName(base) + INDEX_SUFFIX)
+        )
+        segment.log.createNewFile()
+        segment.index.createNewFile()
+        return segment
+    }
+
+    private fun deleteSegment(segment: Segment) {
+        segment.log.delete()
+        segment.index.delete()
+    }
+
+    private fun readLineStarts(segment: Segment): IntArray {
+        if (!segment.index.exists()) return IntArray(0)
+        return try {
+            RandomAccessFile(segment.index, "r").channel.use { channel ->
+                val count = (channel.size() / Int.SIZE_BYTES).toInt()
+                if (count == 0) return IntArray(0)
+                val buffer = channel.map(FileChannel.MapMode.READ_ONLY, 0, count.toLong() * Int.SIZE_BYTES)
+                IntArray(count).also { buffer.asIntBuffer().get(it) }
+            }
+        } catch (e: IOException) {
+            Log.w(TAG, "Failed to read log index ${segment.index.name}", e)
+            IntArray(0)
+        }
+    }
+
+    private fun findLineStartBefore(segments: List<Segment>, offset: Long, maxLines: Int): Long {
+        var remaining = maxLines
+        for (segment in segments.asReversed()) {
+            if (segment.base >= offset) continue
+            val limit = offset - segment.base
+            val starts = readLineStarts(segment)
+            var i = starts.size - 1
+            while (i >= 0 && starts[i] >= limit) i--
+            val available = i + 1
+            if (available >= remaining) return segment.base + starts[available - remaining]
+            remaining -= available
+        }
+        return segments.first().base
+    }
+
+    private fun readRange(segments: List<Segment>, start: Long, end: Long, reset: Boolean): LogChunk? {
+        val lines = ArrayList<String>()
+        var consumed = start
+        try {
+            for (segment in segments) {
+                val segmentEnd = segment.base + segment.size
+                if (segmentEnd <= consumed || segment.base >= end) continue
+                val from = consumed - segment.base
+                val to = minOf(end, segmentEnd) - segment.base
+                RandomAccessFile(segment.log, "r").channel.use { channel ->
+                    val buffer = channel.map(FileChannel.MapMode.READ_ONLY, from, to - from)
+                    val lastNewline = decodeLines(buffer, lines)
+                    if (lastNewline >= 0) consumed = segment.base + from + lastNewline + 1
                 }
+                if (consumed < segment.base + to) break
             }
         } catch (e: IOException) {
-            Log.e(TAG, "Error reading log file", e)
+            Log.e(TAG, "Error reading log segments", e)
             return null
         }
-        return logContent.toString()
+        return LogChunk(lines, start, consumed, reset)
     }
 
-    @Synchronized
-    fun clearLogs() {
-        if (logFile.exists()) {
-            try {
-                FileWriter(logFile, false).use { fileWriter ->
-                    fileWriter.write("")
-                    Log.d(TAG, "Log file content cleared successfully.")
+    private fun decodeLines(buffer: ByteBuffer, out: MutableList<String>): Int {
+        val bytes = ByteArray(buffer.remaining())
+        buffer.get(bytes)
+        var lineStart = 0
+        var lastNewline = -1
+        for (i in bytes.indices) {
+            if (bytes[i] == NEWLINE) {
+                if (i > lineStart) {
+                    val line = String(bytes, lineStart, i - lineStart, Charsets.UTF_8)
+                    if (line.isNotBlank()) out.add(line)
                 }
-            } catch (e: IOException) {
-                Log.e(TAG, "Failed to clear log file content.", e)
+                lineStart = i + 1
+                lastNewline = i
             }
-        } else {
-            Log.d(TAG, "Log file does not exist, no content to clear.")
         }
+        return lastNewline
+    }
+
+    private fun enqueue(entry: Any) {
+        pending.offer(entry)
+        val thread = writerThread ?: startWriter()
+        if (writerIdle.get()) LockSupport.unpark(thread)
     }
 
     @Synchronized
-    private fun checkAndTruncateLogFile() {
-        if (!logFile.exists()) {
-            Log.d(TAG, "Log file does not exist for truncation check.")
-            return
+    private fun startWriter(): Thread {
+        writerThread?.let { return it }
+        val thread = Thread(::runWriter, "LogWriter").apply { isDaemon = true }
+        writerThread = thread
+        thread.start()
+        return thread
+    }
+
+    private inner class SegmentWriter {
+        private val retained = ArrayDeque<Segment>()
+        private var retainedBytes = 0L
+        private var active: Segment
+        private var activeSize = 0L
+        private var logOut: BufferedOutputStream
+        private var indexOut: DataOutputStream
+
+        init {
+            exportFile.delete()
+            val existing = listSegments()
+            val reusable = existing.lastOrNull()?.takeIf { it.size == 0L }
+            existing.forEach {
+                if (it === reusable) return@forEach
+                retained.addLast(it)
+                retainedBytes += it.size
+            }
+            val end = existing.lastOrNull()?.let { it.base + it.size } ?: 0
+            active = reusable ?: createSegment(end)
+            retained.addLast(active)
+            logOut = BufferedOutputStream(FileOutputStream(active.log, true), WRITE_BUFFER_SIZE)
+            indexOut = DataOutputStream(
+                BufferedOutputStream(FileOutputStream(active.index, true), INDEX_BUFFER_SIZE)
+            )
+            dropExpired()
         }
-        val currentSize = logFile.length()
-        if (currentSize <= MAX_LOG_SIZE_BYTES) {
+
+        fun writeLine(line: String) {
+            if (activeSize >= SEGMENT_SIZE_BYTES) rotate(active.base + activeSize)
+            val bytes = (line + "\n").toByteArray(Charsets.UTF_8)
+            indexOut.writeInt(activeSize.toInt())
+            logOut.write(bytes)
+            activeSize += bytes.size
+            retainedBytes += bytes.size
+        }
+
+        fun flush() {
+            logOut.flush()
+            indexOut.flush()
+        }
+
+        fun clear() {
+            val end = active.base + activeSize
+            close()
+            retained.forEach { deleteSegment(it) }
+            retained.clear()
+            retainedBytes = 0
+            openActive(end)
+            Log.d(TAG, "Log segments cleared.")
+        }
+
+        fun close() {
+            try {
+                flush()
+                logOut.close()
+                indexOut.close()
+            } catch (e: IOException) {
+                Log.e(TAG, "Error closing log segment", e)
+            }
+        }
+
+        private fun rotate(base: Long) {
+            close()
+            openActive(base)
+            dropExpired()
+        }
+
+        private fun openActive(base: Long) {
+            active = createSegment(base)
+            activeSize = 0
+            retained.addLast(active)
+            logOut = BufferedOutputStream(FileOutputStream(active.log, true), WRITE_BUFFER_SIZE)
+            indexOut = DataOutputStream(
+                BufferedOutputStream(FileOutputStream(active.index, true), INDEX_BUFFER_SIZE)
+            )
+        }
+
+        private fun dropExpired() {
+            while (retainedBytes > MAX_LOG_SIZE_BYTES && retained.size > 1) {
+                val oldest = retained.removeFirst()
+                retainedBytes -= oldest.size
+                deleteSegment(oldest)
+            }
+        }
+    }
+
+    private fun runWriter() {
+        val writer = try {
+            SegmentWriter()
+        } catch (e: IOException) {
+            Log.e(TAG, "Failed to open log segment for append", e)
+            writerThread = null
             return
         }
-        Log.d(
-            TAG,
-            "Log file size ($currentSize bytes) exceeds limit ($MAX_LOG_SIZE_BYTES bytes). Truncating oldest $TRUNCATE_SIZE_BYTES bytes."
-        )
+        var dirty = false
         try {
-            val startByteToKeep = currentSize - TRUNCATE_SIZE_BYTES
-            RandomAccessFile(logFile, "rw").use { raf ->
-                raf.seek(startByteToKeep)
-                val firstLineToKeepStartPos: Long
-                val firstPartialOrFullLine = raf.readLine()
-                if (firstPartialOrFullLine != null) {
-                    firstLineToKeepStartPos = raf.filePointer
-                } else {
-                    Log.w(
-                        TAG,
-                        "Could not read line from calculated start position for truncation. Clearing file as a fallback."
-                    )
-                    clearLogs()
-                    return
-                }
-                raf.channel.use { sourceChannel ->
-                    val tempLogFile = File(logFile.parentFile, "$LOG_FILE_NAME.tmp")
-                    FileOutputStream(tempLogFile).use { fos ->
-                        fos.channel.use { destChannel ->
-                            val bytesToTransfer = sourceChannel.size() - firstLineToKeepStartPos
-                            sourceChannel.transferTo(
-                                firstLineToKeepStartPos,
-                                bytesToTransfer,
-                                destChannel
-                            )
-                        }
+            while (true) {
+                val entry = pending.poll()
+                if (entry == null) {
+                    if (dirty) {
+                        writer.flush()
+                        dirty = false
+                        onLogsWritten?.invoke()
                     }
-                    if (logFile.delete()) {
-                        if (tempLogFile.renameTo(logFile)) {
-                            Log.d(
-                                TAG,
-                                "Log file truncated successfully. New size: " + logFile.length() + " bytes."
-                            )
-                        } else {
-                            Log.e(TAG, "Failed to rename temp log file to original file.")
-                            tempLogFile.delete()
-                        }
-                    } else {
-                        Log.e(TAG, "Failed to delete original log file during truncation.")
-                        tempLogFile.delete()
+                    writerIdle.set(true)
+                    if (pending.isEmpty()) LockSupport.parkNanos(IDLE_PARK_NANOS)
+                    writerIdle.set(false)
+                    continue
+                }
+                when (entry) {
+                    STOP_MARKER -> break
+                    CLEAR_MARKER -> {
+                        writer.clear()
+                        dirty = true
+                        continue
                     }
                 }
+                pendingCount.decrementAndGet()
+                try {
+                    val dropped = droppedCount.getAndSet(0)
+                    if (dropped > 0) writer.writeLine("[$dropped log lines dropped]")
+                    writer.writeLine(entry as String)
+                    dirty = true
+                } catch (e: IOException) {
+                    Log.e(TAG, "Error appending log to segment", e)
+                }
             }
-        } catch (e: IOException) {
-            Log.e(TAG, "Error during log file truncation", e)
-            clearLogs()
-        } catch (e: SecurityException) {
-            Log.e(TAG, "Security exception during log file truncation", e)
-            clearLogs()
+        } finally {
+            writer.close()
+            onLogsWritten?.invoke()
+            writerThread = null
         }
     }
 
     companion object {
         private const val TAG = "LogFileManager"
-        private const val LOG_FILE_NAME = "app_log.txt"
+        private const val LOG_DIR_NAME = "logs"
+        private const val LOG_SUFFIX = ".log"
+        private const val INDEX_SUFFIX = ".idx"
+        private const val EXPORT_FILE_NAME = "app_log.txt"
+        private const val SEGMENT_SIZE_BYTES = (1024 * 1024).toLong()
         private const val MAX_LOG_SIZE_BYTES = (10 * 1024 * 1024).toLong()
-        private const val TRUNCATE_SIZE_BYTES = (5 * 1024 * 1024).toLong()
+        private const val MAX_PENDING_ENTRIES = 8192
+        private const val WRITE_BUFFER_SIZE = 64 * 1024
+        private const val INDEX_BUFFER_SIZE = 4 * 1024
+        private const val IDLE_PARK_NANOS = 500_000_000L
+        private const val NEWLINE = '\n'.code.toByte()
+        private val CLEAR_MARKER = Any()
+        private val STOP_MARKER = Any()
     }
-}
\ No newline at end of file
+}
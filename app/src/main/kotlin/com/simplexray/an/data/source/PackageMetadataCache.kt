@@ -0,0 +1,188 @@
+package com.simplexray.an.data.source
+
+import android.Manifest
+import android.content.Context
+import android.content.pm.ApplicationInfo
+import android.content.pm.PackageInfo
+import android.content.pm.PackageManager
+import android.provider.Settings
+import android.util.Log
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.async
+import kotlinx.coroutines.awaitAll
+import kotlinx.coroutines.coroutineScope
+import java.io.File
+import java.io.IOException
+import java.util.Locale
+
+/**
+ * Labels and flags of every installed package, persisted so the app list doesn't resolve
+ * hundreds of labels on each open. The package manager's change sequence number tells which
+ * packages were added, updated or removed since the cache was written, so an unchanged device
+ * costs one binder call; after a reboot the sequence restarts and entries are revalidated by
+ * `lastUpdateTime` instead. Labels are stored in the locale they were resolved in, and all of them
+ * are resolved again once the locale changes. Icons are not stored here; they are loaded per
+ * visible row.
+ */
+class PackageMetadataCache(private val context: Context) {
+    class Entry(
+        val packageName: String,
+        val lastUpdateTime: Long,
+        val uid: Int,
+        val isSystemApp: Boolean,
+        val hasInternetPermission: Boolean,
+        val label: String
+    )
+
+    private val file = File(context.cacheDir, FILE_NAME)
+    private val packageManager = context.packageManager
+
+    private var bootCount = -1
+    private var sequenceNumber = -1
+    private var localeTag = ""
+    private var entries: MutableMap<String, Entry>? = null
+
+    /** Current metadata of all installed packages; resolves only what changed since last time. */
+    suspend fun refresh(): List<Entry> {
+        val cached = entries ?: load().also { entries = it }
+        val currentBoot = currentBootCount()
+        val currentLocale = Locale.getDefault().toLanguageTag()
+        if (bootCount == currentBoot && sequenceNumber >= 0 && localeTag == currentLocale) {
+            val changed = packageManager.getChangedPackages(sequenceNumber)
+                ?: return cached.values.toList()
+            resolveAll(changed.packageNames).zip(changed.packageNames).forEach { (entry, name) ->
+                if (entry != null) cached[name] = entry else cached.remove(name)
+            }
+            sequenceNumber = changed.sequenceNumber
+            save(cached)
+            return cached.values.toList()
+        }
+
+        val sequence = packageManager.getChangedPackages(0)?.sequenceNumber ?: 0
+        val installed = packageManager.getInstalledPackages(0)
+        if (installed.size <= 1) return installed.mapNotNull { resolve(it) }
+        val stale = if (localeTag != currentLocale) installed
+        else installed.filter { cached[it.packageName]?.lastUpdateTime != it.lastUpdateTime }
+        val fresh = resolveAll(stale.map { it.packageName })
+        val result = HashMap<String, Entry>(installed.size)
+        installed.forEach { info -> cached[info.packageName]?.let { result[info.packageName] = it } }
+        fresh.forEach { entry -> entry?.let { result[it.packageName] = it } }
+        entries = result
+        bootCount = currentBoot
+        sequenceNumber = sequence
+        localeTag = currentLocale
+        save(result)
+        Log.d(TAG, "Resolved ${stale.size} of ${installed.size} packages")
+        return result.values.toList()
+    }
+
+    private suspend fun resolveAll(names: List<String>): List<Entry?> = coroutineScope {
+        names.chunked(RESOLVE_CHUNK_SIZE).map { chunk ->
+            async(Dispatchers.IO) {
+                chunk.map { name ->
+                    try {
+                        resolve(packageManager.getPackageInfo(name, PackageManager.GET_PERMISSIONS))
+                    } catch (e: PackageManager.NameNotFoundException) {
+                        null
+                    }
+                }
+            }
+        }.awaitAll().flatten()
+    }
+
+    private fun resolve(info: PackageInfo): Entry? {
+        val appInfo = info.applicationInfo ?: return null
+        val permissions = info.requestedPermissions ?: packageManager.getPackageInfo(
+            info.packageName,
+            PackageManager.GET_PERMISSIONS
+        ).requestedPermissions
+        return Entry(
+            packageName = info.packageName,
+            lastUpdateTime = info.lastUpdateTime,
+            uid = appInfo.uid,
+            isSystemApp = appInfo.flags and ApplicationInfo.FLAG_SYSTEM != 0,
+            hasInternetPermission = permissions?.contains(Manifest.permission.INTERNET) == true,
+            label = appInfo.loadLabel(packageManager).toString()
+        )
+    }
+
+    /**
+     * Names of installed packages for the tunnel's per-app rules, or null if the cache can't
+     * vouch for them. Packages changed since the cache was written are included, since they may
+     * be new installs.
+     */
+    fun installedPackageNames(): Set<String>? {
+        val cached = entries ?: load().also { entries = it }
+        if (cached.isEmpty() || bootCount != currentBootCount() || sequenceNumber < 0) return null
+        val changed = packageManager.getChangedPackages(sequenceNumber)
+            ?: return cached.keys.toSet()
+        return cached.keys + changed.packageNames
+    }
+
+    private fun currentBootCount(): Int =
+        Settings.Global.getInt(context.contentResolver, Settings.Global.BOOT_COUNT, -1)
+
+    private fun load(): MutableMap<String, Entry> {
+        val result = HashMap<String, Entry>()
+        if (!file.exists()) return result
+        try {
+            file.bufferedReader().useLines { lines ->
+                val iterator = lines.iterator()
+                if (!iterator.hasNext()) return result
+                val header = iterator.next().split('\t')
+                if (header.size != 4 || header[0] != FORMAT_VERSION) return result
+                bootCount = header[1].toIntOrNull() ?: -1
+                sequenceNumber = header[2].toIntOrNull() ?: -1
+                localeTag = header[3]
+                iterator.forEach { line ->
+                    val fields = line.split('\t', limit = 5)
+                    if (fields.size != 5) return@forEach
+                    val flags = fields[3].toIntOrNull() ?: return@forEach
+                    result[fields[0]] = Entry(
+                        packageName = fields[0],
+                        lastUpdateTime = fields[1].toLongOrNull() ?: return@forEach,
+                        uid = fields[2].toIntOrNull() ?: return@forEach,
+                        isSystemApp = flags and FLAG_SYSTEM != 0,
+                        hasInternetPermission = flags and FLAG_INTERNET != 0,
+                        label = fields[4]
+                    )
+                }
+            }
+        } catch (e: IOException) {
+            Log.w(TAG, "Failed to read package metadata cache", e)
+            result.clear()
+        }
+        return result
+    }
+
+    private fun save(values: Map<String, Entry>) {
+        val tempFile = File(file.path + ".tmp")
+        try {
+            tempFile.bufferedWriter().use { writer ->
+                writer.write("$FORMAT_VERSION\t$bootCount\t$sequenceNumber\t$localeTag\n")
+                values.values.forEach { entry ->
+                    var flags = 0
+                    if (entry.isSystemApp) flags = flags or FLAG_SYSTEM
+                    if (entry.hasInternetPermission) flags = flags or FLAG_INTERNET
+                    val label = entry.label.replace('\t', ' ').replace('\n', ' ')
+                    writer.write(
+                        "${entry.packageName}\t${entry.lastUpdateTime}\t${entry.uid}\t$flags\t$label\n"
+                    )
+                }
+            }
+            if (!tempFile.renameTo(file)) throw IOException("Failed to replace ${file.name}")
+        } catch (e: IOException) {
+            tempFile.delete()
+            Log.w(TAG, "Failed to write package metadata cache", e)
+        }
+    }
+
+    companion object {
+        private const val TAG = "PackageMetadataCache"
+        private const val FILE_NAME = "package_metadata.tsv"
+        private const val FORMAT_VERSION = "2"
+        private const val FLAG_SYSTEM = 1
+        private const val FLAG_INTERNET = 2
+        private const val RESOLVE_CHUNK_SIZE = 32
+    }
+}
@@ -0,0 +1,81 @@
+package com.simplexray.an.data.source
+
+import android.util.Log
+import java.io.File
+import java.io.FileInputStream
+import java.io.FileOutputStream
+import java.io.IOException
+import java.util.Properties
+
+/**
+ * Remembers where each rule file on disk came from, together with the size and mtime it had
+ * when written. A file whose stat still matches its entry is known to be unchanged, so startup
+ * never has to hash it, and downloads can revalidate with the stored ETag/Last-Modified.
+ */
+class RuleFileManifest(dir: File) {
+    private val file = File(dir, "rule_files.properties")
+    private val properties = Properties()
+
+    init {
+        if (file.exists()) {
+            try {
+                FileInputStream(file).use { properties.load(it) }
+            } catch (e: IOException) {
+                Log.w(TAG, "Failed to read rule file manifest", e)
+            }
+        }
+    }
+
+    /** True when [target] is the file last recorded for [source] and hasn't been touched since. */
+    @Synchronized
+    fun matches(target: File, source: String): Boolean {
+        val name = target.name
+        return target.exists() &&
+                properties.getProperty("$name.source") == source &&
+                properties.getProperty("$name.size") == target.length().toString() &&
+                properties.getProperty("$name.mtime") == target.lastModified().toString()
+    }
+
+    @Synchronized
+    fun etag(name: String): String? = properties.getProperty("$name.etag")
+
+    @Synchronized
+    fun lastModified(name: String): String? = properties.getProperty("$name.lastModified")
+
+    @Synchronized
+    fun record(
+        target: File,
+        source: String,
+        etag: String? = null,
+        lastModified: String? = null
+    ) {
+        val name = target.name
+        properties.setProperty("$name.source", source)
+        properties.setProperty("$name.size", target.length().toString())
+        properties.setProperty("$name.mtime", target.lastModified().toString())
+        setOrRemove("$name.etag", etag)
+        setOrRemove("$name.lastModified", lastModified)
+        save()
+    }
+
+    private fun setOrRemove(key: String, value: String?) {
+        if (value == null) properties.remove(key) else properties.setProperty(key, value)
+    }
+
+    private fun save() {
+        val tempFile = File(file.path + ".tmp")
+        try {
+            FileOutputStream(tempFile).use { properties.store(it, null) }
+            if (!tempFile.renameTo(file)) throw IOException("Failed to replace ${file.name}")
+        } catch (e: IOException) {
+            tempFile.delete()
+            Log.w(TAG, "Failed to write rule file manifest", e)
+        }
+    }
+
+    companion object {
+        private const val TAG = "RuleFileManifest"
+
+        fun downloadSource(url: String) = "url:$url"
+    }
+}
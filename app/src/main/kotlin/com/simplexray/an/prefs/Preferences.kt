@@ -3,11 +3,14 @@ package com.simplexray.an.prefs
 import android.content.ContentResolver
 import android.content.ContentValues
 import android.content.Context
+import android.database.ContentObserver
 import android.util.Log
 import com.google.gson.Gson
 import com.google.gson.reflect.TypeToken
 import com.simplexray.an.R
+import com.simplexray.an.common.TcpBufferSizing
 import com.simplexray.an.common.ThemeMode
+import java.util.concurrent.atomic.AtomicInteger
 
 class Preferences(context: Context) {
     private val contentResolver: ContentResolver
@@ -20,6 +23,7 @@ class Preferences(context: Context) {
     }
 
     private fun getPrefData(key: String): Pair<String?, String?> {
+        loadSnapshot(contentResolver)?.let { return it[key] ?: Pair(null, null) }
         val uri = PrefsContract.PrefsEntry.CONTENT_URI.buildUpon().appendPath(key).build()
         try {
             contentResolver.query(
@@ -93,6 +97,8 @@ class Preferences(context: Context) {
             }
         } catch (e: Exception) {
             Log.e(TAG, "Error setting preference for key: $key", e)
+        } finally {
+            invalidateSnapshot()
         }
     }
 
@@ -130,8 +136,59 @@ class Preferences(context: Context) {
             setValueInProvider(DNS_IPV6, addr)
         }
 
-    val udpInTcp: Boolean
+    var udpInTcp: Boolean
         get() = getBooleanPref(UDP_IN_TCP, false)
+        set(enable) {
+            setValueInProvider(UDP_IN_TCP, enable)
+        }
+
+    var udpRecvBufferSize: Int
+        get() = getPrefData(UDP_RECV_BUFFER_SIZE).first?.toIntOrNull() ?: 524288
+        set(value) {
+            setValueInProvider(UDP_RECV_BUFFER_SIZE, value.toString())
+        }
+
+    var udpCopyBufferNums: Int
+        get() = getPrefData(UDP_COPY_BUFFER_NUMS).first?.toIntOrNull() ?: 10
+        set(value) {
+            setValueInProvider(UDP_COPY_BUFFER_NUMS, value.toString())
+        }
+
+    var mapDns: Boolean
+        get() = getBooleanPref(MAP_DNS, false)
+        set(enable) {
+            setValueInProvider(MAP_DNS, enable)
+        }
+
+    var mapDnsCacheSize: Int
+        get() = getPrefData(MAP_DNS_CACHE_SIZE).first?.toIntOrNull() ?: 10000
+        set(value) {
+            setValueInProvider(MAP_DNS_CACHE_SIZE, value.toString())
+        }
+
+    /**
+     * `libxray -version` output cached against the binary it came from, see [kernelVersionKey].
+     */
+    var kernelVersion: String?
+        get() = getPrefData(KERNEL_VERSION).first
+        set(value) {
+            setValueInProvider(KERNEL_VERSION, value)
+        }
+
+    var kernelVersionKey: String?
+        get() = getPrefData(KERNEL_VERSION_KEY).first
+        set(value) {
+            setValueInProvider(KERNEL_VERSION_KEY, value)
+        }
+
+    val mapDnsAddress: String
+        get() = "198.18.0.2"
+
+    val mapDnsNetwork: String
+        get() = "100.64.0.0"
+
+    val mapDnsNetmask: String
+        get() = "255.192.0.0"
 
     var ipv4: Boolean
         get() = getBooleanPref(IPV4, true)
@@ -181,8 +238,55 @@ class Preferences(context: Context) {
             setValueInProvider(DISABLE_VPN, value)
         }
 
-    val tunnelMtu: Int
-        get() = 8500
+    var tcpBufferSize: Int
+        get() = getPrefData(TCP_BUFFER_SIZE).first?.toIntOrNull() ?: TcpBufferSizing.DEFAULT_SIZE
+        set(value) {
+            setValueInProvider(TCP_BUFFER_SIZE, value.toString())
+        }
+
+    /** Round trip through the proxy from the last probe, for [TcpBufferSizing.ADAPTIVE]. */
+    var measuredRttMs: Int
+        get() = getPrefData(MEASURED_RTT_MS).first?.toIntOrNull() ?: 0
+        set(value) {
+            setValueInProvider(MEASURED_RTT_MS, value.toString())
+        }
+
+    /** Peak tunnel rate in bytes per second, for [TcpBufferSizing.ADAPTIVE]. */
+    var measuredBandwidth: Long
+        get() = getPrefData(MEASURED_BANDWIDTH).first?.toLongOrNull() ?: 0
+        set(value) {
+            setValueInProvider(MEASURED_BANDWIDTH, value.toString())
+        }
+
+    var tcpIdleTimeout: Int
+        get() = getPrefData(TCP_IDLE_TIMEOUT).first?.toIntOrNull() ?: 300000
+        set(value) {
+            setValueInProvider(TCP_IDLE_TIMEOUT, value.toString())
+        }
+
+    var udpIdleTimeout: Int
+        get() = getPrefData(UDP_IDLE_TIMEOUT).first?.toIntOrNull() ?: 60000
+        set(value) {
+            setValueInProvider(UDP_IDLE_TIMEOUT, value.toString())
+        }
+
+    var autoSelectConfig: Boolean
+        get() = getBooleanPref(AUTO_SELECT_CONFIG, false)
+        set(value) {
+            setValueInProvider(AUTO_SELECT_CONFIG, value)
+        }
+
+    var serviceTracing: Boolean
+        get() = getBooleanPref(SERVICE_TRACING, false)
+        set(value) {
+            setValueInProvider(SERVICE_TRACING, value)
+        }
+
+    var tunnelMtu: Int
+        get() = getPrefData(TUNNEL_MTU).first?.toIntOrNull() ?: 8500
+        set(value) {
+            setValueInProvider(TUNNEL_MTU, value.toString())
+        }
 
     val tunnelIpv4Address: String
         get() = "198.18.0.1"
@@ -211,6 +315,12 @@ class Preferences(context: Context) {
             setValueInProvider(BYPASS_LAN, enable)
         }
 
+    var socksPipeline: Boolean
+        get() = getBooleanPref(SOCKS_PIPELINE, false)
+        set(enable) {
+            setValueInProvider(SOCKS_PIPELINE, enable)
+        }
+
     var useTemplate: Boolean
         get() = getBooleanPref(USE_TEMPLATE, true)
         set(enable) {
@@ -328,6 +438,95 @@ class Preferences(context: Context) {
         const val API_PORT: String = "ApiPort"
         const val BYPASS_SELECTED_APPS: String = "BypassSelectedApps"
         const val THEME: String = "Theme"
+        const val TUNNEL_MTU: String = "TunnelMtu"
+        const val SOCKS_PIPELINE: String = "SocksPipeline"
+        const val UDP_RECV_BUFFER_SIZE: String = "UdpRecvBufferSize"
+        const val UDP_COPY_BUFFER_NUMS: String = "UdpCopyBufferNums"
+        const val MAP_DNS: String = "MapDns"
+        const val MAP_DNS_CACHE_SIZE: String = "MapDnsCacheSize"
+        const val KERNEL_VERSION: String = "KernelVersion"
+        const val KERNEL_VERSION_KEY: String = "KernelVersionKey"
+        const val AUTO_SELECT_CONFIG: String = "AutoSelectConfig"
+        const val SERVICE_TRACING: String = "ServiceTracing"
+        const val TCP_BUFFER_SIZE: String = "TcpBufferSize"
+        const val MEASURED_RTT_MS: String = "MeasuredRttMs"
+        const val MEASURED_BANDWIDTH: String = "MeasuredBandwidth"
+        const val TCP_IDLE_TIMEOUT: String = "TcpIdleTimeout"
+        const val UDP_IDLE_TIMEOUT: String = "UdpIdleTimeout"
         private const val TAG = "Preferences"
+
+        @Volatile
+        private var snapshot: Map<String, Pair<String?, String?>>? = null
+        private val snapshotVersion = AtomicInteger()
+        private var observerRegistered = false
+
+        private fun invalidateSnapshot() {
+            snapshotVersion.incrementAndGet()
+            snapshot = null
+        }
+
+        /**
+         * Drops this process's snapshot. The change notification from the other process is
+         * asynchronous and may arrive after the intent or broadcast that followed its write, so
+         * every cross-process handoff calls this before reading what the sender just wrote.
+         */
+        fun invalidate() = invalidateSnapshot()
+
+        /**
+         * Returns every preference of the provider from one query, shared by all instances in
+         * this process. Writes from this process drop it right away; writes from the other
+         * process arrive through the provider's change notification, or [invalidate] at a
+         * handoff. A snapshot read while a change was in flight is used once but not kept.
+         * Returns null if the query fails, so callers fall back to per-key queries.
+         */
+        private fun loadSnapshot(contentResolver: ContentResolver): Map<String, Pair<String?, String?>>? {
+            snapshot?.let { return it }
+            val version = snapshotVersion.get()
+            synchronized(this) {
+                if (!observerRegistered) {
+                    contentResolver.registerContentObserver(
+                        PrefsContract.PrefsEntry.CONTENT_URI,
+                        true,
+                        object : ContentObserver(null) {
+                            override fun onChange(selfChange: Boolean) {
+                                invalidateSnapshot()
+                            }
+                        }
+                    )
+                    observerRegistered = true
+                }
+            }
+            val values = HashMap<String, Pair<String?, String?>>()
+            try {
+                contentResolver.query(
+                    PrefsContract.PrefsEntry.CONTENT_URI, arrayOf(
+                        PrefsContract.PrefsEntry.COLUMN_PREF_KEY,
+                        PrefsContract.PrefsEntry.COLUMN_PREF_VALUE,
+                        PrefsContract.PrefsEntry.COLUMN_PREF_TYPE
+                    ), null, null, null
+                )?.use { cursor ->
+                    val keyColumnIndex =
+                        cursor.getColumnIndex(PrefsContract.PrefsEntry.COLUMN_PREF_KEY)
+                    val valueColumnIndex =
+                        cursor.getColumnIndex(PrefsContract.PrefsEntry.COLUMN_PREF_VALUE)
+                    val typeColumnIndex =
+                        cursor.getColumnIndex(PrefsContract.PrefsEntry.COLUMN_PREF_TYPE)
+                    if (keyColumnIndex == -1) return null
+                    while (cursor.moveToNext()) {
+                        val key = cursor.getString(keyColumnIndex) ?: continue
+                        val value =
+                            if (valueColumnIndex != -1) cursor.getString(valueColumnIndex) else null
+                        val type =
+                            if (typeColumnIndex != -1) cursor.getString(typeColumnIndex) else null
+                        values[key] = Pair(value, type)
+                    }
+                } ?: return null
+            } catch (e: Exception) {
+                Log.e(TAG, "Error reading preference snapshot", e)
+                return null
+            }
+            if (snapshotVersion.get() == version) snapshot = values
+            return values
+        }
     }
 }
\ No newline at end of file
@@ -77,6 +77,19 @@ class PrefsProvider : ContentProvider() {
             if (value != null) {
                 cursor.addRow(arrayOf<Any?>(key, value.toString(), type))
             }
+        } else {
+            for ((entryKey, value) in prefs.all) {
+                val type = when (value) {
+                    is String -> "String"
+                    is Boolean -> "Boolean"
+                    is Int -> "Integer"
+                    is Long -> "Long"
+                    is Float -> "Float"
+                    is Set<*> -> "StringSet"
+                    else -> continue
+                }
+                cursor.addRow(arrayOf<Any?>(entryKey, value.toString(), type))
+            }
         }
         return cursor
     }
@@ -15,84 +15,147 @@ import android.os.Handler
 import android.os.IBinder
 import android.os.Looper
 import android.os.ParcelFileDescriptor
+import android.os.SystemClock
 import android.util.Log
 import androidx.core.app.NotificationCompat
 import com.simplexray.an.BuildConfig
 import com.simplexray.an.R
 import com.simplexray.an.activity.MainActivity
-import com.simplexray.an.common.ConfigUtils
-import com.simplexray.an.common.ConfigUtils.extractPortsFromJson
+import com.simplexray.an.common.ConfigLatencyTester
+import com.simplexray.an.common.OutboundHealth
+import com.simplexray.an.common.PreparedConfigCache
+import com.simplexray.an.common.ServiceTrace
+import com.simplexray.an.common.StartupTrace
+import com.simplexray.an.common.TcpBufferSizing
+import com.simplexray.an.common.TunnelMemoryBudget
+import com.simplexray.an.common.TunnelStatsRegion
 import com.simplexray.an.data.source.LogFileManager
+import com.simplexray.an.data.source.PackageMetadataCache
 import com.simplexray.an.prefs.Preferences
+import kotlinx.coroutines.CompletableDeferred
 import kotlinx.coroutines.CoroutineScope
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.Job
 import kotlinx.coroutines.SupervisorJob
+import kotlinx.coroutines.async
 import kotlinx.coroutines.cancel
+import kotlinx.coroutines.delay
+import kotlinx.coroutines.isActive
 import kotlinx.coroutines.launch
+import kotlinx.coroutines.runBlocking
+import kotlinx.coroutines.sync.Mutex
+import kotlinx.coroutines.sync.withLock
 import java.io.BufferedReader
 import java.io.File
 import java.io.FileOutputStream
 import java.io.IOException
 import java.io.InputStreamReader
 import java.io.InterruptedIOException
+import java.net.InetAddress
+import java.net.InetSocketAddress
+import java.net.NetworkInterface
 import java.net.ServerSocket
+import java.net.SocketException
+import java.net.URL
+import java.util.concurrent.TimeUnit
 import kotlin.concurrent.Volatile
 import kotlin.system.exitProcess
 
 class TProxyService : VpnService() {
     private val serviceScope = CoroutineScope(Dispatchers.IO + SupervisorJob())
     private val handler = Handler(Looper.getMainLooper())
-    private val logBroadcastBuffer: MutableList<String> = mutableListOf()
     private val broadcastLogsRunnable = Runnable {
-        synchronized(logBroadcastBuffer) {
-            if (logBroadcastBuffer.isNotEmpty()) {
-                val logUpdateIntent = Intent(ACTION_LOG_UPDATE)
-                logUpdateIntent.setPackage(application.packageName)
-                logUpdateIntent.putStringArrayListExtra(
-                    EXTRA_LOG_DATA, ArrayList(logBroadcastBuffer)
-                )
-                sendBroadcast(logUpdateIntent)
-                logBroadcastBuffer.clear()
-                Log.d(TAG, "Broadcasted a batch of logs.")
-            }
-        }
+        val logUpdateIntent = Intent(ACTION_LOG_UPDATE)
+        logUpdateIntent.setPackage(application.packageName)
+        sendBroadcast(logUpdateIntent)
     }
 
-    private fun findAvailablePort(excludedPorts: Set<Int>): Int? {
-        (10000..65535)
-            .shuffled()
-            .forEach { port ->
-                if (port in excludedPorts) return@forEach
-                runCatching {
-                    ServerSocket(port).use { socket ->
-                        socket.reuseAddress = true
-                    }
-                    port
-                }.onFailure {
-                    Log.d(TAG, "Port $port unavailable: ${it.message}")
-                }.onSuccess {
-                    return port
-                }
-            }
+    /**
+     * Keeps the previous API port when it is still free, so reloads and reconnects leave the
+     * stats client's target unchanged, and otherwise lets the kernel pick an ephemeral port.
+     */
+    private fun findAvailablePort(previousPort: Int, excludedPorts: Set<Int>): Int? {
+        if (previousPort in 1..65535 && previousPort !in excludedPorts && canBind(previousPort)) {
+            return previousPort
+        }
+        repeat(PORT_ALLOCATION_ATTEMPTS) {
+            val port = runCatching {
+                ServerSocket(0, 1, InetAddress.getLoopbackAddress()).use { it.localPort }
+            }.onFailure {
+                Log.d(TAG, "Ephemeral port allocation failed: ${it.message}")
+            }.getOrNull() ?: return@repeat
+            if (port !in excludedPorts) return port
+        }
         return null
     }
 
+    private fun canBind(port: Int): Boolean = runCatching {
+        ServerSocket().use { socket ->
+            socket.reuseAddress = true
+            socket.bind(InetSocketAddress(InetAddress.getLoopbackAddress(), port))
+        }
+    }.isSuccess
+
     private lateinit var logFileManager: LogFileManager
+    private val configCache by lazy { PreparedConfigCache(cacheDir) }
 
     @Volatile
     private var xrayProcess: Process? = null
     private var tunFd: ParcelFileDescriptor? = null
+    private var statsRegion: TunnelStatsRegion? = null
+    private var statsJob: Job? = null
+    private var tunnelStartJob: Job? = null
+
+    /** Completed once the connect's core has its API port, or with false if it never gets one. */
+    @Volatile
+    private var apiPortAssigned = CompletableDeferred<Boolean>()
+
+    /** `misc.tcp-buffer-size` the running tunnel was configured with, published with the stats. */
+    @Volatile
+    private var effectiveTcpBufferSize = 0
+
+    @Volatile
+    private var memoryBudget: TunnelMemoryBudget? = null
 
     @Volatile
     private var reloadingRequested = false
 
+    /** Config the running core was started with, before stats injection. */
+    @Volatile
+    private var runningConfigContent: String? = null
+    private val reloadMutex = Mutex()
+
+    private val outboundHealth = OutboundHealth()
+    private var autoSelectJob: Job? = null
+    private var probeCursor = 0
+
+    @Volatile
+    private var nextAutoSelectAt = SystemClock.elapsedRealtime() + AUTO_SELECT_INITIAL_DELAY_MS
+
+    private var flowSampleJob: Job? = null
+    private var nextFlowSampleAt = 0L
+
+    /** Core-only mode's stand-in for the stats loop; see [startPeriodicTicker]. */
+    private var tickerJob: Job? = null
+
+    /** Kernel name of the TUN interface, for its drop counters; resolved on first use. */
+    @Volatile
+    private var tunInterfaceName: String? = null
+
     override fun onCreate() {
         super.onCreate()
         logFileManager = LogFileManager(this)
+        ServiceTrace.enabled = Preferences(this).serviceTracing
+        logFileManager.onLogsWritten = {
+            if (!handler.hasCallbacks(broadcastLogsRunnable)) {
+                handler.postDelayed(broadcastLogsRunnable, BROADCAST_DELAY_MS)
+            }
+        }
         Log.d(TAG, "TProxyService created.")
     }
 
     override fun onStartCommand(intent: Intent, flags: Int, startId: Int): Int {
+        Preferences.invalidate()
         val action = intent.action
         when (action) {
             ACTION_DISCONNECT -> {
@@ -104,9 +167,7 @@ class TProxyService : VpnService() {
                 val prefs = Preferences(this)
                 if (prefs.disableVpn) {
                     Log.d(TAG, "Received RELOAD_CONFIG action (core-only mode)")
-                    reloadingRequested = true
-                    xrayProcess?.destroy()
-                    serviceScope.launch { runXrayProcess() }
+                    reloadXray()
                     return START_STICKY
                 }
                 if (tunFd == null) {
@@ -114,9 +175,18 @@ class TProxyService : VpnService() {
                     return START_STICKY
                 }
                 Log.d(TAG, "Received RELOAD_CONFIG action.")
-                reloadingRequested = true
-                xrayProcess?.destroy()
-                serviceScope.launch { runXrayProcess() }
+                reloadXray()
+                return START_STICKY
+            }
+
+            ACTION_DUMP_TRACE -> {
+                dumpTrace()
+                return START_STICKY
+            }
+
+            ACTION_PERIODIC_SETTINGS -> {
+                // In VPN mode the stats loop picks the change up on its next pass.
+                if (Preferences(this).disableVpn && xrayProcess != null) startPeriodicTicker()
                 return START_STICKY
             }
 
@@ -124,10 +194,13 @@ class TProxyService : VpnService() {
                 logFileManager.clearLogs()
                 val prefs = Preferences(this)
                 if (prefs.disableVpn) {
-                    serviceScope.launch { runXrayProcess() }
-                    val successIntent = Intent(ACTION_START)
-                    successIntent.setPackage(application.packageName)
-                    sendBroadcast(successIntent)
+                    val trace = newStartupTrace("Connect", parts = 1)
+                    apiPortAssigned = CompletableDeferred()
+                    serviceScope.launch { runXrayProcess(trace) }
+                    startPeriodicTicker()
+                    serviceScope.launch {
+                        if (apiPortAssigned.await()) broadcastStarted()
+                    }
 
                     @Suppress("SameParameterValue") val channelName = "nosocks"
                     initNotificationChannel(channelName)
@@ -153,6 +226,7 @@ class TProxyService : VpnService() {
 
     override fun onDestroy() {
         super.onDestroy()
+        logFileManager.close()
         handler.removeCallbacks(broadcastLogsRunnable)
         broadcastLogsRunnable.run()
         serviceScope.cancel()
@@ -165,12 +239,53 @@ class TProxyService : VpnService() {
         super.onRevoke()
     }
 
+    /**
+     * Starts the core and the tunnel side by side: the core process boots its runtime while the
+     * VPN interface is established, and the config work overlaps with both.
+     */
     private fun startXray() {
-        startService()
-        serviceScope.launch { runXrayProcess() }
+        val trace = newStartupTrace("Connect", parts = 2)
+        apiPortAssigned = CompletableDeferred()
+        serviceScope.launch { runXrayProcess(trace) }
+        startService(trace)
     }
 
-    private fun runXrayProcess() {
+    private fun newStartupTrace(label: String, parts: Int) =
+        StartupTrace(label, parts) { logFileManager.appendLog(it) }
+
+    private fun reloadXray() {
+        serviceScope.launch {
+            val hotReloaded = reloadMutex.withLock { tryHotReload() }
+            if (hotReloaded) return@launch
+            reloadingRequested = true
+            xrayProcess?.let {
+                it.destroy()
+                it.waitFor(PROCESS_EXIT_TIMEOUT_MS, TimeUnit.MILLISECONDS)
+            }
+            runXrayProcess(newStartupTrace("Reload", parts = 1))
+        }
+    }
+
+    /**
+     * Keeps the running core when the selected config didn't actually change. Anything else
+     * restarts it: mutating the core through its API would need HandlerService and
+     * RoutingService on a listener other apps can connect to.
+     */
+    private fun tryHotReload(): Boolean {
+        if (xrayProcess?.isAlive != true) return false
+        val oldContent = runningConfigContent ?: return false
+        val newContent = Preferences(applicationContext).selectedConfigPath
+            ?.let { runCatching { File(it).readText() }.getOrNull() } ?: return false
+        if (newContent != oldContent) return false
+        Log.d(TAG, "Config unchanged, keeping the running core.")
+        return true
+    }
+
+    /**
+     * The core reads its config from stdin, so it is spawned first and boots its runtime while
+     * the port scan and stats injection run here.
+     */
+    private fun runXrayProcess(trace: StartupTrace) {
         var currentProcess: Process? = null
         try {
             Log.d(TAG, "Attempting to start xray process.")
@@ -178,34 +293,43 @@ class TProxyService : VpnService() {
             val prefs = Preferences(applicationContext)
             val selectedConfigPath = prefs.selectedConfigPath ?: return
             val xrayPath = "$libraryDir/libxray.so"
-            val configContent = File(selectedConfigPath).readText()
-            val apiPort = findAvailablePort(extractPortsFromJson(configContent)) ?: return
-            prefs.apiPort = apiPort
-            Log.d(TAG, "Found and set API port: $apiPort")
+            val configContent = trace.stage("read_config") { File(selectedConfigPath).readText() }
 
             val processBuilder = getProcessBuilder(xrayPath)
-            currentProcess = processBuilder.start()
-            this.xrayProcess = currentProcess
+            val process = trace.stage("spawn") { processBuilder.start() }
+            currentProcess = process
+            this.xrayProcess = process
+
+            val apiPort = trace.stage("api_port") {
+                findAvailablePort(prefs.apiPort, configCache.usedPorts(prefs, configContent))
+            } ?: return
+            prefs.apiPort = apiPort
+            apiPortAssigned.complete(true)
+            Log.d(TAG, "Found and set API port: $apiPort")
 
             Log.d(TAG, "Writing config to xray stdin from: $selectedConfigPath")
-            val injectedConfigContent =
-                ConfigUtils.injectStatsService(prefs, configContent)
-            currentProcess.outputStream.use { os ->
-                os.write(injectedConfigContent.toByteArray())
-                os.flush()
+            val injectedConfigContent = trace.stage("inject_config") {
+                configCache.injectedConfig(prefs, configContent)
+            }
+            trace.stage("write_config") {
+                process.outputStream.use { os ->
+                    os.write(injectedConfigContent.toByteArray())
+                    os.flush()
+                }
             }
+            runningConfigContent = configContent
 
-            val inputStream = currentProcess.inputStream
+            val inputStream = process.inputStream
             val reader = BufferedReader(InputStreamReader(inputStream))
             var line: String
+            var firstLine = true
             Log.d(TAG, "Reading xray process output.")
             while ((reader.readLine().also { line = it }) != null) {
                 logFileManager.appendLog(line)
-                synchronized(logBroadcastBuffer) {
-                    logBroadcastBuffer.add(line)
-                    if (!handler.hasCallbacks(broadcastLogsRunnable)) {
-                        handler.postDelayed(broadcastLogsRunnable, BROADCAST_DELAY_MS)
-                    }
+                if (firstLine) {
+                    firstLine = false
+                    trace.mark("core_output")
+                    trace.complete()
                 }
             }
             Log.d(TAG, "xray process output stream finished.")
@@ -214,6 +338,7 @@ class TProxyService : VpnService() {
         } catch (e: Exception) {
             Log.e(TAG, "Error executing xray", e)
         } finally {
+            apiPortAssigned.complete(false)
             Log.d(TAG, "Xray process task finished.")
             if (reloadingRequested) {
                 Log.d(TAG, "Xray process stopped due to configuration reload.")
@@ -224,6 +349,7 @@ class TProxyService : VpnService() {
             }
             if (this.xrayProcess === currentProcess) {
                 this.xrayProcess = null
+                runningConfigContent = null
             } else {
                 Log.w(TAG, "Finishing task for an old xray process instance.")
             }
@@ -254,41 +380,343 @@ class TProxyService : VpnService() {
         stopService()
     }
 
-    private fun startService() {
+    private fun startService(trace: StartupTrace) {
         if (tunFd != null) return
         val prefs = Preferences(this)
+        val tproxyFileDeferred = serviceScope.async {
+            trace.stage("tproxy_conf") { writeTproxyConf(prefs) }
+        }
         val builder = getVpnBuilder(prefs)
-        tunFd = builder.establish()
-        if (tunFd == null) {
+        val fd = trace.stage("establish") { builder.establish() }
+        tunFd = fd
+        if (fd == null) {
+            tproxyFileDeferred.cancel()
             stopXray()
             return
         }
+        tunnelStartJob = serviceScope.launch {
+            val tproxyFile = tproxyFileDeferred.await()
+            if (tproxyFile == null) {
+                // stopService joins this job, so it must not run inside it.
+                handler.post { stopXray() }
+                return@launch
+            }
+            trace.stage("tunnel") {
+                ServiceTrace.section("TProxyStartService") {
+                    TProxyStartService(tproxyFile.absolutePath, fd.fd)
+                }
+            }
+            startStatsPublisher()
+            trace.complete()
+            if (apiPortAssigned.await()) broadcastStarted()
+        }
+
+        @Suppress("SameParameterValue") val channelName = "socks5"
+        initNotificationChannel(channelName)
+        createNotification(channelName)
+    }
+
+    /** Announces the connection once the tunnel runs and the stats API port is known. */
+    private fun broadcastStarted() {
+        val successIntent = Intent(ACTION_START)
+        successIntent.setPackage(application.packageName)
+        sendBroadcast(successIntent)
+    }
+
+    private fun writeTproxyConf(prefs: Preferences): File? {
         val tproxyFile = File(cacheDir, "tproxy.conf")
-        try {
+        return try {
             tproxyFile.createNewFile()
+            val requestedBufferSize = TcpBufferSizing.effectiveSize(
+                prefs.tcpBufferSize,
+                prefs.measuredRttMs,
+                prefs.measuredBandwidth
+            )
+            if (prefs.tcpBufferSize == TcpBufferSizing.ADAPTIVE) {
+                logFileManager.appendLog(
+                    "Tunnel TCP buffer: $requestedBufferSize bytes (RTT ${prefs.measuredRttMs} ms, " +
+                            "peak ${prefs.measuredBandwidth} B/s)"
+                )
+            }
+            val budget =
+                TunnelMemoryBudget.forDevice(this, prefs.taskStackSize, requestedBufferSize)
+            memoryBudget = budget
+            val tcpBufferSize = budget.tcpBufferSize
+            effectiveTcpBufferSize = tcpBufferSize
+            if (tcpBufferSize != requestedBufferSize) {
+                logFileManager.appendLog(
+                    "Tunnel TCP buffer lowered from $requestedBufferSize to $tcpBufferSize bytes " +
+                            "to fit the memory budget"
+                )
+            }
+            val sessionBytes = budget.taskStackSize + 2L * tcpBufferSize
+            if (budget.maxSessionCount * sessionBytes > budget.budgetBytes) {
+                logFileManager.appendLog(
+                    "Tunnel stacks are too large for the memory budget; " +
+                            "${budget.maxSessionCount} sessions may use " +
+                            "${budget.maxSessionCount * sessionBytes} bytes"
+                )
+            }
+            logFileManager.appendLog(
+                "Tunnel memory budget: ${budget.budgetBytes} bytes, " +
+                        "${budget.maxSessionCount} sessions, ${budget.taskStackSize} byte stacks"
+            )
             FileOutputStream(tproxyFile, false).use { fos ->
-                val tproxyConf = getTproxyConf(prefs)
+                val tproxyConf = getTproxyConf(prefs, tcpBufferSize, budget)
                 fos.write(tproxyConf.toByteArray())
             }
+            tproxyFile
         } catch (e: IOException) {
             Log.e(TAG, e.toString())
-            stopXray()
-            return
+            null
         }
-        tunFd?.fd?.let { fd ->
-            TProxyStartService(tproxyFile.absolutePath, fd)
-        } ?: run {
-            Log.e(TAG, "tunFd is null after establish()")
-            stopXray()
+    }
+
+    private fun startStatsPublisher() {
+        val region = TunnelStatsRegion.openWriter(this) ?: return
+        statsRegion = region
+        region.publishConfig(effectiveTcpBufferSize, memoryBudget)
+        statsJob = serviceScope.launch {
+            val peakTracker = PeakRateTracker(Preferences(applicationContext))
+            while (isActive) {
+                val stats = ServiceTrace.section("TProxyGetStats") { TProxyGetStats() }
+                if (stats != null) {
+                    region.publish(stats, TunnelMemoryBudget.residentBytes())
+                    peakTracker.update(stats)
+                } else {
+                    ServiceTrace.drop(ServiceTrace.DropCause.STATS_UNAVAILABLE)
+                }
+                if (ServiceTrace.enabled) {
+                    readTunDrops().forEach { (name, value) -> ServiceTrace.counter(name, value) }
+                }
+                onPeriodicWakeup()
+                delayMeasuringLag(
+                    if (region.hasActiveReader()) STATS_PUBLISH_INTERVAL_MS
+                    else STATS_IDLE_PUBLISH_INTERVAL_MS
+                )
+            }
+        }
+    }
+
+    /**
+     * Rides on the service's existing periodic loop instead of a timer of its own, so the auto
+     * select rounds never add a wakeup. Returns how long until something is due again, at least
+     * the idle publish interval, or null if neither auto select nor tracing is on.
+     */
+    private fun onPeriodicWakeup(): Long? {
+        val now = SystemClock.elapsedRealtime()
+        val prefs = Preferences(applicationContext)
+        ServiceTrace.enabled = prefs.serviceTracing
+        if (ServiceTrace.enabled && now >= nextFlowSampleAt && flowSampleJob?.isActive != true) {
+            nextFlowSampleAt = now + FLOW_SAMPLE_INTERVAL_MS
+            flowSampleJob = serviceScope.launch(Dispatchers.IO) { sampleFlow(prefs) }
+        }
+        val autoSelect = prefs.autoSelectConfig
+        if (now >= nextAutoSelectAt && autoSelectJob?.isActive != true) {
+            if (autoSelect) {
+                autoSelectJob = serviceScope.launch {
+                    ServiceTrace.asyncSection("autoSelectRound") { runAutoSelectRound(prefs) }
+                }
+            } else {
+                nextAutoSelectAt = now + AUTO_SELECT_INTERVAL_MS
+            }
+        }
+        val nextDue = listOfNotNull(
+            nextFlowSampleAt.takeIf { ServiceTrace.enabled },
+            nextAutoSelectAt.takeIf { autoSelect }
+        ).minOrNull() ?: return null
+        return (nextDue - now).coerceAtLeast(STATS_IDLE_PUBLISH_INTERVAL_MS)
+    }
+
+    /**
+     * Without a tunnel there is no stats loop to ride on, so core-only mode gets a loop of its
+     * own that sleeps until [onPeriodicWakeup] has something due and ends once nothing is
+     * enabled; [ACTION_PERIODIC_SETTINGS] starts it again when a setting is switched back on.
+     */
+    private fun startPeriodicTicker() {
+        if (tickerJob?.isActive == true) return
+        tickerJob = serviceScope.launch {
+            while (isActive) {
+                val next = onPeriodicWakeup() ?: break
+                delayMeasuringLag(next)
+            }
+        }
+    }
+
+    /** [delay] that feeds how late the loop woke up into the [ServiceTrace] lag histogram. */
+    private suspend fun delayMeasuringLag(intervalMs: Long) {
+        val expected = SystemClock.uptimeMillis() + intervalMs
+        delay(intervalMs)
+        ServiceTrace.recordLoopLag(SystemClock.uptimeMillis() - expected)
+    }
+
+    /**
+     * Times one request through the running core's SOCKS inbound, split into the phases of
+     * [ConfigLatency]. The TUN side is inside the native tunnel and not visible from here.
+     */
+    private fun sampleFlow(prefs: Preferences) {
+        // Java's SOCKS client can only authenticate through a global Authenticator.
+        if (prefs.socksUsername.isNotEmpty()) return
+        val target = runCatching { URL(prefs.connectivityTestTarget) }.getOrNull() ?: return
+        val tester = ConfigLatencyTester(
+            xrayPath = "${getNativeLibraryDir(applicationContext)}/libxray.so",
+            workingDir = filesDir,
+            targetUrl = target,
+            timeoutMs = prefs.connectivityTestTimeout
+        )
+        var at = ServiceTrace.now()
+        val latency = tester.probe(prefs.socksPort)
+        if (latency == null) {
+            ServiceTrace.drop(ServiceTrace.DropCause.FLOW_SAMPLE_FAILED)
             return
         }
+        val phases = listOfNotNull(
+            "flow.socks_connect" to latency.tcpMs,
+            latency.tlsMs?.let { "flow.tls" to it },
+            "flow.first_byte" to latency.firstByteMs
+        )
+        for ((name, ms) in phases) {
+            ServiceTrace.recordAsync(name, at, ms * NANOS_PER_MS)
+            at += ms * NANOS_PER_MS
+        }
+    }
 
-        val successIntent = Intent(ACTION_START)
-        successIntent.setPackage(application.packageName)
-        sendBroadcast(successIntent)
-        @Suppress("SameParameterValue") val channelName = "socks5"
-        initNotificationChannel(channelName)
-        createNotification(channelName)
+    /**
+     * Kernel counters of the TUN interface. `tx_dropped` grows when the interface queue overflows
+     * because the tunnel isn't reading fast enough. Newer releases may deny sysfs to apps, in which
+     * case this is empty.
+     */
+    private fun readTunDrops(): Map<String, Long> {
+        val name = tunInterfaceName
+            ?: resolveTunInterfaceName()?.also { tunInterfaceName = it }
+            ?: return emptyMap()
+        return TUN_DROP_STATS.mapNotNull { stat ->
+            try {
+                "tun_$stat" to File("/sys/class/net/$name/statistics/$stat").readText().trim()
+                    .toLong()
+            } catch (e: IOException) {
+                null
+            } catch (e: NumberFormatException) {
+                null
+            }
+        }.toMap()
+    }
+
+    private fun resolveTunInterfaceName(): String? {
+        if (tunFd == null) return null
+        val address = Preferences(applicationContext).tunnelIpv4Address
+        return try {
+            NetworkInterface.getNetworkInterfaces()?.toList()?.firstOrNull { iface ->
+                iface.inetAddresses.toList().any { it.hostAddress == address }
+            }?.name
+        } catch (e: SocketException) {
+            null
+        }
+    }
+
+    private fun dumpTrace() {
+        serviceScope.launch(Dispatchers.IO) {
+            val file = File(filesDir, TRACE_FILE_NAME)
+            val success = try {
+                ServiceTrace.dump(file, readTunDrops())
+                true
+            } catch (e: IOException) {
+                Log.e(TAG, "Failed to write service trace", e)
+                false
+            }
+            val dumpedIntent = Intent(ACTION_TRACE_DUMPED)
+            dumpedIntent.setPackage(application.packageName)
+            dumpedIntent.putExtra(EXTRA_SUCCESS, success)
+            sendBroadcast(dumpedIntent)
+        }
+    }
+
+    /**
+     * Probes the running config, the best known alternative and a few others in rotation, then
+     * switches through the reload path if [OutboundHealth] finds the running one degraded.
+     * A failing running config brings the next round forward.
+     */
+    private suspend fun runAutoSelectRound(prefs: Preferences) {
+        nextAutoSelectAt = SystemClock.elapsedRealtime() + AUTO_SELECT_INTERVAL_MS
+        val current = prefs.selectedConfigPath?.let { File(it) } ?: return
+        val configs = prefs.configFilesOrder.map { File(filesDir, it) }.filter { it.isFile }
+        if (configs.size < 2) return
+        val target = runCatching { URL(prefs.connectivityTestTarget) }.getOrNull() ?: return
+        outboundHealth.retainAll(configs.map { it.name }.toSet())
+
+        val others = configs.filter { it.name != current.name }
+        val best = others.minByOrNull { outboundHealth.score(it.name) ?: Double.MAX_VALUE }
+        val batch = linkedSetOf(current)
+        best?.let { batch.add(it) }
+        repeat(minOf(AUTO_SELECT_ROTATION, others.size)) {
+            batch.add(others[probeCursor++ % others.size])
+        }
+
+        val tester = ConfigLatencyTester(
+            xrayPath = "${getNativeLibraryDir(applicationContext)}/libxray.so",
+            workingDir = filesDir,
+            targetUrl = target,
+            timeoutMs = prefs.connectivityTestTimeout
+        )
+        var currentFailed = false
+        tester.testAll(batch.toList()) { file, latency ->
+            outboundHealth.record(file.name, latency)
+            if (file == current) {
+                if (latency == null) currentFailed = true
+                else prefs.measuredRttMs = latency.firstByteMs.toInt()
+            }
+        }
+        if (currentFailed) {
+            nextAutoSelectAt = SystemClock.elapsedRealtime() + AUTO_SELECT_RETRY_MS
+        }
+
+        val replacement = outboundHealth.pickReplacement(current.name) ?: return
+        logFileManager.appendLog("Auto-select: switching from ${current.name} to $replacement")
+        prefs.selectedConfigPath = File(filesDir, replacement).absolutePath
+        val selectedIntent = Intent(ACTION_CONFIG_SELECTED)
+        selectedIntent.setPackage(application.packageName)
+        sendBroadcast(selectedIntent)
+        reloadXray()
+    }
+
+    /**
+     * Keeps the peak tunnel rate as the bandwidth half of the adaptive buffer's BDP. It starts from
+     * the stored peak, so a new session only ever raises it, and only a clear new peak is written,
+     * so a steady transfer doesn't hit the provider every tick.
+     */
+    private class PeakRateTracker(private val prefs: Preferences) {
+        private var lastTx = -1L
+        private var lastRx = -1L
+        private var lastAt = 0L
+        private var peak = prefs.measuredBandwidth
+
+        /** The rate is that of the busier direction this tick, not of the larger total. */
+        fun update(stats: LongArray) {
+            if (stats.size < 4) return
+            val tx = stats[1]
+            val rx = stats[3]
+            val now = SystemClock.elapsedRealtime()
+            if (lastTx >= 0 && now > lastAt && tx >= lastTx && rx >= lastRx) {
+                val rate = maxOf(tx - lastTx, rx - lastRx) * 1000 / (now - lastAt)
+                if (rate >= MIN_PEAK_RATE && rate > peak + peak / 4) {
+                    peak = rate
+                    prefs.measuredBandwidth = rate
+                }
+            }
+            lastTx = tx
+            lastRx = rx
+            lastAt = now
+        }
+    }
+
+    private fun stopStatsPublisher() {
+        statsJob?.cancel()
+        statsJob = null
+        statsRegion?.let {
+            it.clear()
+            it.close()
+        }
+        statsRegion = null
     }
 
     private fun getVpnBuilder(prefs: Preferences): Builder = Builder().apply {
@@ -303,33 +731,49 @@ class TProxyService : VpnService() {
         if (prefs.httpProxyEnabled) {
             setHttpProxy(ProxyInfo.buildDirectProxy("127.0.0.1", prefs.socksPort))
         }
+        val mapDns = prefs.mapDns && prefs.ipv4
         if (prefs.ipv4) {
             addAddress(prefs.tunnelIpv4Address, prefs.tunnelIpv4Prefix)
             addRoute("0.0.0.0", 0)
-            prefs.dnsIpv4.takeIf { it.isNotEmpty() }?.also { addDnsServer(it) }
+            if (mapDns) {
+                addDnsServer(prefs.mapDnsAddress)
+            } else {
+                prefs.dnsIpv4.takeIf { it.isNotEmpty() }?.also { addDnsServer(it) }
+            }
         }
         if (prefs.ipv6) {
             addAddress(prefs.tunnelIpv6Address, prefs.tunnelIpv6Prefix)
             addRoute("::", 0)
-            prefs.dnsIpv6.takeIf { it.isNotEmpty() }?.also { addDnsServer(it) }
+            if (!mapDns) {
+                prefs.dnsIpv6.takeIf { it.isNotEmpty() }?.also { addDnsServer(it) }
+            }
         }
 
-        prefs.apps?.forEach { appName ->
+        val apps = prefs.apps
+        val bypassSelectedApps = prefs.bypassSelectedApps
+        // Selected apps that have since been uninstalled are skipped without a failed lookup.
+        val installed = if (apps.isNullOrEmpty()) null
+        else PackageMetadataCache(this@TProxyService).installedPackageNames()
+        apps?.forEach { appName ->
             appName?.let { name ->
+                if (installed != null && name !in installed) return@let
                 try {
                     when {
-                        prefs.bypassSelectedApps -> addDisallowedApplication(name)
+                        bypassSelectedApps -> addDisallowedApplication(name)
                         else -> addAllowedApplication(name)
                     }
                 } catch (ignored: PackageManager.NameNotFoundException) {
                 }
             }
         }
-        if (prefs.bypassSelectedApps || prefs.apps.isNullOrEmpty())
+        if (bypassSelectedApps || apps.isNullOrEmpty())
             addDisallowedApplication(BuildConfig.APPLICATION_ID)
     }
 
     private fun stopService() {
+        // The native side must not be handed an fd that is closed, or already reused, mid-start.
+        tunnelStartJob?.let { job -> runBlocking { job.join() } }
+        tunnelStartJob = null
         tunFd?.let {
             try {
                 it.close()
@@ -338,7 +782,8 @@ class TProxyService : VpnService() {
                 tunFd = null
             }
             stopForeground(Service.STOP_FOREGROUND_REMOVE)
-            TProxyStopService()
+            stopStatsPublisher()
+            ServiceTrace.section("TProxyStopService") { TProxyStopService() }
         }
         exit()
     }
@@ -381,9 +826,26 @@ class TProxyService : VpnService() {
         const val ACTION_STOP: String = "com.simplexray.an.STOP"
         const val ACTION_LOG_UPDATE: String = "com.simplexray.an.LOG_UPDATE"
         const val ACTION_RELOAD_CONFIG: String = "com.simplexray.an.RELOAD_CONFIG"
-        const val EXTRA_LOG_DATA: String = "log_data"
+        const val ACTION_CONFIG_SELECTED: String = "com.simplexray.an.CONFIG_SELECTED"
+        const val ACTION_DUMP_TRACE: String = "com.simplexray.an.DUMP_TRACE"
+        const val ACTION_PERIODIC_SETTINGS: String = "com.simplexray.an.PERIODIC_SETTINGS"
+        const val ACTION_TRACE_DUMPED: String = "com.simplexray.an.TRACE_DUMPED"
+        const val EXTRA_SUCCESS: String = "success"
+        const val TRACE_FILE_NAME: String = "service_trace.json"
         private const val TAG = "VpnService"
-        private const val BROADCAST_DELAY_MS: Long = 3000
+        private const val BROADCAST_DELAY_MS: Long = 1000
+        private const val STATS_PUBLISH_INTERVAL_MS: Long = 1000
+        private const val STATS_IDLE_PUBLISH_INTERVAL_MS: Long = 10000
+        private const val PROCESS_EXIT_TIMEOUT_MS: Long = 2000
+        private const val PORT_ALLOCATION_ATTEMPTS = 8
+        private const val AUTO_SELECT_INITIAL_DELAY_MS: Long = 30_000
+        private const val AUTO_SELECT_INTERVAL_MS: Long = 5 * 60_000
+        private const val AUTO_SELECT_RETRY_MS: Long = 60_000
+        private const val AUTO_SELECT_ROTATION = 3
+        private const val MIN_PEAK_RATE: Long = 64 * 1024
+        private const val FLOW_SAMPLE_INTERVAL_MS: Long = 60_000
+        private const val NANOS_PER_MS = 1_000_000L
+        private val TUN_DROP_STATS = listOf("rx_dropped", "tx_dropped", "rx_errors", "tx_errors")
 
         init {
             System.loadLibrary("hev-socks5-tunnel")
@@ -422,9 +884,19 @@ class TProxyService : VpnService() {
             }
         }
 
-        private fun getTproxyConf(prefs: Preferences): String {
+        private fun getTproxyConf(
+            prefs: Preferences,
+            tcpBufferSize: Int,
+            budget: TunnelMemoryBudget
+        ): String {
             var tproxyConf = """misc:
-  task-stack-size: ${prefs.taskStackSize}
+  task-stack-size: ${budget.taskStackSize}
+  tcp-buffer-size: $tcpBufferSize
+  max-session-count: ${budget.maxSessionCount}
+  tcp-read-write-timeout: ${prefs.tcpIdleTimeout}
+  udp-read-write-timeout: ${prefs.udpIdleTimeout}
+  udp-recv-buffer-size: ${prefs.udpRecvBufferSize}
+  udp-copy-buffer-nums: ${prefs.udpCopyBufferNums}
 tunnel:
   mtu: ${prefs.tunnelMtu}
 """
@@ -432,11 +904,21 @@ tunnel:
   port: ${prefs.socksPort}
   address: '${prefs.socksAddress}'
   udp: '${if (prefs.udpInTcp) "tcp" else "udp"}'
+  pipeline: ${prefs.socksPipeline}
 """
             if (prefs.socksUsername.isNotEmpty() && prefs.socksPassword.isNotEmpty()) {
                 tproxyConf += "  username: '" + prefs.socksUsername + "'\n"
                 tproxyConf += "  password: '" + prefs.socksPassword + "'\n"
             }
+            if (prefs.mapDns && prefs.ipv4) {
+                tproxyConf += """mapdns:
+  address: ${prefs.mapDnsAddress}
+  port: 53
+  network: ${prefs.mapDnsNetwork}
+  netmask: ${prefs.mapDnsNetmask}
+  cache-size: ${prefs.mapDnsCacheSize}
+"""
+            }
             return tproxyConf
         }
     }
@@ -5,6 +5,7 @@ import androidx.compose.foundation.layout.fillMaxWidth
 import androidx.compose.foundation.lazy.LazyListState
 import androidx.compose.material.icons.Icons
 import androidx.compose.material.icons.automirrored.filled.ArrowBack
+import androidx.compose.material.icons.filled.Check
 import androidx.compose.material.icons.filled.Clear
 import androidx.compose.material.icons.filled.MoreVert
 import androidx.compose.material3.DropdownMenu
@@ -46,6 +47,7 @@ import com.simplexray.an.common.ROUTE_CONFIG
 import com.simplexray.an.common.ROUTE_LOG
 import com.simplexray.an.common.ROUTE_SETTINGS
 import com.simplexray.an.common.ROUTE_STATS
+import com.simplexray.an.common.log.LogLevel
 import com.simplexray.an.viewmodel.LogViewModel
 import com.simplexray.an.viewmodel.MainViewModel
 import kotlinx.coroutines.delay
@@ -300,6 +302,7 @@ private fun ConfigActions(
 ) {
     var expanded by remember { mutableStateOf(false) }
     val scope = rememberCoroutineScope()
+    val isTestingLatencies by mainViewModel.isTestingLatencies.collectAsState()
 
     IconButton(
         onClick = onSwitchVpnService,
@@ -349,6 +352,14 @@ private fun ConfigActions(
             },
             enabled = isServiceEnabled
         )
+        DropdownMenuItem(
+            text = { Text(stringResource(R.string.test_all_configs)) },
+            onClick = {
+                mainViewModel.testAllConfigLatencies()
+                expanded = false
+            },
+            enabled = !isTestingLatencies
+        )
     }
 }
 
@@ -360,6 +371,8 @@ private fun LogActions(
 ) {
     var expanded by remember { mutableStateOf(false) }
     val hasLogsToExport by logViewModel.hasLogsToExport.collectAsStateWithLifecycle()
+    val levelFilter by logViewModel.levelFilter.collectAsStateWithLifecycle()
+    val connectionFilter by logViewModel.connectionFilter.collectAsStateWithLifecycle()
 
     IconButton(onClick = { onLogSearchingChange(true) }) {
         Icon(
@@ -385,6 +398,35 @@ private fun LogActions(
             },
             enabled = hasLogsToExport
         )
+        if (connectionFilter != null) {
+            DropdownMenuItem(
+                text = { Text(stringResource(R.string.log_connection_filter_clear)) },
+                onClick = {
+                    logViewModel.clearConnectionFilter()
+                    expanded = false
+                }
+            )
+        }
+        listOf(
+            null to R.string.log_level_all,
+            LogLevel.Debug to R.string.log_level_debug,
+            LogLevel.Info to R.string.log_level_info,
+            LogLevel.Warning to R.string.log_level_warning,
+            LogLevel.Error to R.string.log_level_error
+        ).forEach { (level, label) ->
+            DropdownMenuItem(
+                text = { Text(stringResource(label)) },
+                onClick = {
+                    logViewModel.onLevelFilterChange(level)
+                    expanded = false
+                },
+                trailingIcon = {
+                    if (levelFilter == level) {
+                        Icon(Icons.Default.Check, contentDescription = null)
+                    }
+                }
+            )
+        }
     }
 }
 
@@ -463,6 +505,14 @@ private fun StatsActions(
             },
             enabled = isServiceEnabled
         )
+        DropdownMenuItem(
+            text = { Text(stringResource(R.string.benchmark)) },
+            onClick = {
+                mainViewModel.runBenchmark()
+                expanded = false
+            },
+            enabled = isServiceEnabled
+        )
     }
 }
 
@@ -1,13 +1,12 @@
 package com.simplexray.an.ui.screens
 
-import android.graphics.Bitmap
-import android.graphics.Canvas
-import android.graphics.drawable.BitmapDrawable
-import android.graphics.drawable.Drawable
+import android.content.Intent
+import android.provider.Settings
 import androidx.compose.foundation.Image
 import androidx.compose.foundation.clickable
 import androidx.compose.foundation.layout.Arrangement
 import androidx.compose.foundation.layout.Box
+import androidx.compose.foundation.layout.Column
 import androidx.compose.foundation.layout.PaddingValues
 import androidx.compose.foundation.layout.Row
 import androidx.compose.foundation.layout.Spacer
@@ -49,6 +48,7 @@ import androidx.compose.runtime.LaunchedEffect
 import androidx.compose.runtime.derivedStateOf
 import androidx.compose.runtime.getValue
 import androidx.compose.runtime.mutableStateOf
+import androidx.compose.runtime.produceState
 import androidx.compose.runtime.remember
 import androidx.compose.runtime.setValue
 import androidx.compose.ui.Alignment
@@ -57,20 +57,27 @@ import androidx.compose.ui.draw.clip
 import androidx.compose.ui.focus.FocusRequester
 import androidx.compose.ui.focus.focusRequester
 import androidx.compose.ui.graphics.Color
+import androidx.compose.ui.graphics.ImageBitmap
 import androidx.compose.ui.graphics.asImageBitmap
 import androidx.compose.ui.input.nestedscroll.nestedScroll
 import androidx.compose.ui.layout.ContentScale
 import androidx.compose.ui.platform.LocalContext
+import androidx.compose.ui.platform.LocalDensity
 import androidx.compose.ui.platform.LocalFocusManager
 import androidx.compose.ui.res.painterResource
 import androidx.compose.ui.res.stringResource
 import androidx.compose.ui.text.style.TextOverflow
 import androidx.compose.ui.unit.dp
+import androidx.lifecycle.Lifecycle
+import androidx.lifecycle.compose.LocalLifecycleOwner
+import androidx.lifecycle.repeatOnLifecycle
 import com.simplexray.an.R
+import com.simplexray.an.common.formatBytes
 import com.simplexray.an.ui.theme.ScrollbarDefaults
 import com.simplexray.an.viewmodel.AppListViewModel
 import com.simplexray.an.viewmodel.AppListViewUiEvent
 import com.simplexray.an.viewmodel.Package
+import kotlinx.coroutines.delay
 import kotlinx.coroutines.flow.collectLatest
 import my.nanihadesuka.compose.LazyColumnScrollbar
 
@@ -88,6 +95,19 @@ fun AppListScreen(viewModel: AppListViewModel, onBackClick: () -> Unit) {
     val lazyListState = rememberLazyListState()
     val focusRequester = remember { FocusRequester() }
     val snackbarHostState = remember { SnackbarHostState() }
+    val showTraffic by remember { derivedStateOf { viewModel.showTraffic } }
+    val trafficRates by remember { derivedStateOf { viewModel.trafficRates } }
+    val lifecycleOwner = LocalLifecycleOwner.current
+
+    LaunchedEffect(showTraffic) {
+        if (!showTraffic) return@LaunchedEffect
+        lifecycleOwner.repeatOnLifecycle(Lifecycle.State.RESUMED) {
+            while (true) {
+                viewModel.refreshTraffic()
+                delay(2000)
+            }
+        }
+    }
 
     LaunchedEffect(lazyListState.isScrollInProgress) {
         if (lazyListState.isScrollInProgress) {
@@ -247,6 +267,34 @@ fun AppListScreen(viewModel: AppListViewModel, onBackClick: () -> Unit) {
                                     showMenu = false
                                 })
 
+                            DropdownMenuItem(
+                                text = {
+                                    Row(
+                                        modifier = Modifier.fillMaxWidth(),
+                                        verticalAlignment = Alignment.CenterVertically
+                                    ) {
+                                        Text(
+                                            stringResource(R.string.show_app_traffic),
+                                            modifier = Modifier.weight(1f)
+                                        )
+                                        Checkbox(
+                                            checked = showTraffic,
+                                            onCheckedChange = null
+                                        )
+                                    }
+                                },
+                                onClick = {
+                                    if (!showTraffic && !viewModel.hasUsageAccess()) {
+                                        context.startActivity(
+                                            Intent(Settings.ACTION_USAGE_ACCESS_SETTINGS)
+                                                .addFlags(Intent.FLAG_ACTIVITY_NEW_TASK)
+                                        )
+                                    } else {
+                                        viewModel.onShowTrafficChange(!showTraffic)
+                                    }
+                                    showMenu = false
+                                })
+
                             DropdownMenuItem(
                                 text = {
                                     Row(
@@ -300,7 +348,8 @@ fun AppListScreen(viewModel: AppListViewModel, onBackClick: () -> Unit) {
                         verticalArrangement = Arrangement.spacedBy(4.dp),
                     ) {
                         items(filteredList, key = { it.packageName }) { pkg ->
-                            AppItem(pkg) { isChecked ->
+                            val rate = if (showTraffic) trafficRates.get(pkg.uid, 0) else null
+                            AppItem(pkg, rate, viewModel) { isChecked ->
                                 viewModel.onPackageSelected(pkg, isChecked)
                             }
                         }
@@ -319,9 +368,15 @@ fun AppListScreen(viewModel: AppListViewModel, onBackClick: () -> Unit) {
 }
 
 @Composable
-fun AppItem(pkg: Package, onCheckedChange: (Boolean) -> Unit) {
-    val iconBitmap = remember(pkg.icon) {
-        drawableToBitmap(pkg.icon)?.asImageBitmap()
+fun AppItem(
+    pkg: Package,
+    trafficRate: Long?,
+    viewModel: AppListViewModel,
+    onCheckedChange: (Boolean) -> Unit
+) {
+    val iconSizePx = with(LocalDensity.current) { 40.dp.roundToPx() }
+    val iconBitmap by produceState<ImageBitmap?>(null, pkg.packageName) {
+        value = viewModel.loadIcon(pkg.packageName, iconSizePx)?.asImageBitmap()
     }
     Card(
         modifier = Modifier
@@ -353,13 +408,21 @@ fun AppItem(pkg: Package, onCheckedChange: (Boolean) -> Unit) {
                 )
             }
             Spacer(modifier = Modifier.width(16.dp))
-            Text(
-                text = pkg.label,
-                modifier = Modifier.weight(1f),
-                style = MaterialTheme.typography.bodyLarge,
-                maxLines = 1,
-                overflow = TextOverflow.Ellipsis
-            )
+            Column(modifier = Modifier.weight(1f)) {
+                Text(
+                    text = pkg.label,
+                    style = MaterialTheme.typography.bodyLarge,
+                    maxLines = 1,
+                    overflow = TextOverflow.Ellipsis
+                )
+                trafficRate?.let {
+                    Text(
+                        text = stringResource(R.string.traffic_rate, formatBytes(it)),
+                        style = MaterialTheme.typography.bodySmall,
+                        color = MaterialTheme.colorScheme.onSurfaceVariant
+                    )
+                }
+            }
             Spacer(modifier = Modifier.width(16.dp))
             Checkbox(
                 checked = pkg.selected,
@@ -370,16 +433,3 @@ fun AppItem(pkg: Package, onCheckedChange: (Boolean) -> Unit) {
         }
     }
 }
-
-fun drawableToBitmap(drawable: Drawable): Bitmap? {
-    if (drawable is BitmapDrawable) {
-        return drawable.bitmap
-    }
-    val width = if (drawable.intrinsicWidth > 0) drawable.intrinsicWidth else 64
-    val height = if (drawable.intrinsicHeight > 0) drawable.intrinsicHeight else 64
-    val bitmap = Bitmap.createBitmap(width, height, Bitmap.Config.ARGB_8888)
-    val canvas = Canvas(bitmap)
-    drawable.setBounds(0, 0, canvas.width, canvas.height)
-    drawable.draw(canvas)
-    return bitmap
-}
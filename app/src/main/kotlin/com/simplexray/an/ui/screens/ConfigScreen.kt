@@ -43,6 +43,7 @@ import androidx.lifecycle.Lifecycle
 import androidx.lifecycle.LifecycleEventObserver
 import androidx.lifecycle.compose.LocalLifecycleOwner
 import com.simplexray.an.R
+import com.simplexray.an.common.ConfigLatency
 import com.simplexray.an.viewmodel.MainViewModel
 import sh.calvin.reorderable.ReorderableItem
 import sh.calvin.reorderable.rememberReorderableLazyListState
@@ -64,6 +65,8 @@ fun ConfigScreen(
 
     val files by mainViewModel.configFiles.collectAsState()
     val selectedFile by mainViewModel.selectedConfigFile.collectAsState()
+    val latencies by mainViewModel.configLatencies.collectAsState()
+    val isTestingLatencies by mainViewModel.isTestingLatencies.collectAsState()
 
     val lifecycleOwner = LocalLifecycleOwner.current
 
@@ -150,11 +153,29 @@ fun ConfigScreen(
                                         .padding(16.dp),
                                     verticalAlignment = Alignment.CenterVertically
                                 ) {
-                                    Text(
-                                        file.name.removeSuffix(".json"),
-                                        modifier = Modifier.weight(1f),
-                                        style = MaterialTheme.typography.titleMedium
-                                    )
+                                    Column(modifier = Modifier.weight(1f)) {
+                                        Text(
+                                            file.name.removeSuffix(".json"),
+                                            style = MaterialTheme.typography.titleMedium
+                                        )
+                                        val latencyText = when {
+                                            file in latencies -> latencies[file]
+                                                ?.let { formatConfigLatency(it) }
+                                                ?: stringResource(R.string.config_latency_failed)
+
+                                            isTestingLatencies ->
+                                                stringResource(R.string.config_latency_testing)
+
+                                            else -> null
+                                        }
+                                        latencyText?.let {
+                                            Text(
+                                                it,
+                                                style = MaterialTheme.typography.bodySmall,
+                                                color = MaterialTheme.colorScheme.onSurfaceVariant
+                                            )
+                                        }
+                                    }
                                     IconButton(onClick = { onEditConfigClick(file) }) {
                                         Icon(
                                             painterResource(R.drawable.edit),
@@ -200,3 +221,19 @@ fun ConfigScreen(
         )
     }
 }
+
+@Composable
+private fun formatConfigLatency(latency: ConfigLatency): String {
+    val tls = latency.tlsMs
+    return if (tls != null) {
+        stringResource(
+            R.string.config_latency_tls,
+            latency.totalMs,
+            latency.tcpMs,
+            tls,
+            latency.firstByteMs
+        )
+    } else {
+        stringResource(R.string.config_latency, latency.totalMs, latency.tcpMs, latency.firstByteMs)
+    }
+}
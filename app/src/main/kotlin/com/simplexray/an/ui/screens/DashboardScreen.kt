@@ -9,10 +9,15 @@ import androidx.compose.foundation.layout.fillMaxWidth
 import androidx.compose.foundation.layout.height
 import androidx.compose.foundation.layout.padding
 import androidx.compose.foundation.lazy.LazyColumn
+import androidx.compose.foundation.rememberScrollState
+import androidx.compose.foundation.verticalScroll
+import androidx.compose.material3.AlertDialog
 import androidx.compose.material3.Card
 import androidx.compose.material3.CardDefaults
+import androidx.compose.material3.LinearProgressIndicator
 import androidx.compose.material3.MaterialTheme
 import androidx.compose.material3.Text
+import androidx.compose.material3.TextButton
 import androidx.compose.runtime.Composable
 import androidx.compose.runtime.LaunchedEffect
 import androidx.compose.runtime.collectAsState
@@ -26,28 +31,35 @@ import androidx.lifecycle.Lifecycle
 import androidx.lifecycle.compose.LocalLifecycleOwner
 import androidx.lifecycle.repeatOnLifecycle
 import com.simplexray.an.R
+import com.simplexray.an.common.BenchmarkReport
+import com.simplexray.an.common.BenchmarkStage
+import com.simplexray.an.common.BenchmarkState
 import com.simplexray.an.common.formatBytes
 import com.simplexray.an.common.formatNumber
 import com.simplexray.an.common.formatUptime
 import com.simplexray.an.viewmodel.MainViewModel
-import kotlinx.coroutines.delay
 
 @Composable
 fun DashboardScreen(
     mainViewModel: MainViewModel
 ) {
     val coreStats by mainViewModel.coreStatsState.collectAsState()
+    val benchmarkState by mainViewModel.benchmarkState.collectAsState()
     val lifecycleOwner = LocalLifecycleOwner.current
 
     LaunchedEffect(Unit) {
         lifecycleOwner.repeatOnLifecycle(Lifecycle.State.RESUMED) {
-            while (true) {
-                mainViewModel.updateCoreStats()
-                delay(1000)
-            }
+            mainViewModel.collectCoreStats()
         }
     }
 
+    BenchmarkDialog(
+        state = benchmarkState,
+        onCancel = { mainViewModel.cancelBenchmark() },
+        onDismiss = { mainViewModel.dismissBenchmark() },
+        onExport = { mainViewModel.exportBenchmark() }
+    )
+
     LazyColumn(
         modifier = Modifier
             .fillMaxSize()
@@ -78,6 +90,82 @@ fun DashboardScreen(
                         label = stringResource(id = R.string.stats_downlink),
                         value = formatBytes(coreStats.downlink)
                     )
+                    StatRow(
+                        label = stringResource(id = R.string.stats_uplink_rate),
+                        value = stringResource(R.string.traffic_rate, formatBytes(coreStats.uplinkRate))
+                    )
+                    StatRow(
+                        label = stringResource(id = R.string.stats_downlink_rate),
+                        value = stringResource(R.string.traffic_rate, formatBytes(coreStats.downlinkRate))
+                    )
+                }
+            }
+            Spacer(modifier = Modifier.height(16.dp))
+        }
+
+        item {
+            Card(
+                modifier = Modifier
+                    .fillMaxWidth()
+                    .clip(MaterialTheme.shapes.extraLarge),
+                colors = CardDefaults.cardColors(
+                    containerColor = MaterialTheme.colorScheme.surfaceContainer
+                )
+            ) {
+                Column(modifier = Modifier.padding(20.dp)) {
+                    Text(
+                        text = "Tunnel",
+                        style = MaterialTheme.typography.titleLarge,
+                        modifier = Modifier.padding(bottom = 8.dp)
+                    )
+                    StatRow(
+                        label = stringResource(id = R.string.stats_tunnel_tx_bytes),
+                        value = formatBytes(coreStats.tunnelTxBytes)
+                    )
+                    StatRow(
+                        label = stringResource(id = R.string.stats_tunnel_rx_bytes),
+                        value = formatBytes(coreStats.tunnelRxBytes)
+                    )
+                    StatRow(
+                        label = stringResource(id = R.string.stats_tunnel_tx_rate),
+                        value = stringResource(R.string.traffic_rate, formatBytes(coreStats.tunnelTxRate))
+                    )
+                    StatRow(
+                        label = stringResource(id = R.string.stats_tunnel_rx_rate),
+                        value = stringResource(R.string.traffic_rate, formatBytes(coreStats.tunnelRxRate))
+                    )
+                    StatRow(
+                        label = stringResource(id = R.string.stats_tunnel_tx_packets),
+                        value = formatNumber(coreStats.tunnelTxPackets)
+                    )
+                    StatRow(
+                        label = stringResource(id = R.string.stats_tunnel_rx_packets),
+                        value = formatNumber(coreStats.tunnelRxPackets)
+                    )
+                    if (coreStats.tunnelTcpBufferSize > 0) {
+                        StatRow(
+                            label = stringResource(id = R.string.stats_tunnel_tcp_buffer),
+                            value = formatBytes(coreStats.tunnelTcpBufferSize.toLong())
+                        )
+                    }
+                    if (coreStats.tunnelMemoryBudget > 0) {
+                        StatRow(
+                            label = stringResource(id = R.string.stats_tunnel_memory),
+                            value = stringResource(
+                                R.string.stats_tunnel_memory_value,
+                                formatBytes(coreStats.tunnelResidentBytes),
+                                formatBytes(coreStats.tunnelMemoryBudget)
+                            )
+                        )
+                        StatRow(
+                            label = stringResource(id = R.string.stats_tunnel_max_sessions),
+                            value = formatNumber(coreStats.tunnelMaxSessions.toLong())
+                        )
+                        StatRow(
+                            label = stringResource(id = R.string.stats_tunnel_task_stack),
+                            value = formatBytes(coreStats.tunnelTaskStackSize.toLong())
+                        )
+                    }
                 }
             }
             Spacer(modifier = Modifier.height(16.dp))
@@ -120,6 +208,111 @@ fun DashboardScreen(
     }
 }
 
+@Composable
+private fun BenchmarkDialog(
+    state: BenchmarkState,
+    onCancel: () -> Unit,
+    onDismiss: () -> Unit,
+    onExport: () -> Unit
+) {
+    when (state) {
+        BenchmarkState.Idle -> Unit
+
+        is BenchmarkState.Running -> AlertDialog(
+            onDismissRequest = {},
+            title = { Text(stringResource(R.string.benchmark)) },
+            text = {
+                Column {
+                    Text(
+                        text = stringResource(
+                            R.string.benchmark_running,
+                            stringResource(benchmarkStageLabel(state.stage))
+                        ),
+                        modifier = Modifier.padding(bottom = 16.dp)
+                    )
+                    LinearProgressIndicator(
+                        progress = { (state.stage.ordinal + 1f) / BenchmarkStage.entries.size },
+                        modifier = Modifier.fillMaxWidth()
+                    )
+                }
+            },
+            confirmButton = {},
+            dismissButton = {
+                TextButton(onClick = onCancel) {
+                    Text(stringResource(R.string.cancel))
+                }
+            }
+        )
+
+        is BenchmarkState.Finished -> AlertDialog(
+            onDismissRequest = onDismiss,
+            title = { Text(stringResource(R.string.benchmark)) },
+            text = { BenchmarkReportContent(state.report) },
+            confirmButton = {
+                TextButton(onClick = onExport) {
+                    Text(stringResource(R.string.export))
+                }
+            },
+            dismissButton = {
+                TextButton(onClick = onDismiss) {
+                    Text(stringResource(R.string.close))
+                }
+            }
+        )
+    }
+}
+
+@Composable
+private fun BenchmarkReportContent(report: BenchmarkReport) {
+    val failed = stringResource(R.string.benchmark_failed)
+    Column(modifier = Modifier.verticalScroll(rememberScrollState())) {
+        StatRow(
+            label = stringResource(R.string.benchmark_latency_p50),
+            value = report.latency?.let { formatMs(it.p50Ms) } ?: failed
+        )
+        StatRow(
+            label = stringResource(R.string.benchmark_latency_p99),
+            value = report.latency?.let { formatMs(it.p99Ms) } ?: failed
+        )
+        StatRow(
+            label = stringResource(R.string.benchmark_handshakes),
+            value = report.handshakes
+                ?.let { stringResource(R.string.benchmark_per_second, "%.1f".format(it.perSecond)) }
+                ?: failed
+        )
+        StatRow(
+            label = stringResource(R.string.benchmark_stage_download),
+            value = report.download
+                ?.let { stringResource(R.string.traffic_rate, formatBytes(it.bytesPerSecond)) }
+                ?: failed
+        )
+        StatRow(
+            label = stringResource(R.string.benchmark_stage_upload),
+            value = report.upload
+                ?.let { stringResource(R.string.traffic_rate, formatBytes(it.bytesPerSecond)) }
+                ?: failed
+        )
+        StatRow(
+            label = stringResource(R.string.benchmark_udp_loss),
+            value = report.udp?.let { "%.1f%%".format(it.lossPercent) } ?: failed
+        )
+        StatRow(
+            label = stringResource(R.string.benchmark_udp_jitter),
+            value = report.udp?.let { formatMs(it.jitterMs) } ?: failed
+        )
+    }
+}
+
+private fun benchmarkStageLabel(stage: BenchmarkStage): Int = when (stage) {
+    BenchmarkStage.Latency -> R.string.benchmark_stage_latency
+    BenchmarkStage.Handshakes -> R.string.benchmark_stage_handshakes
+    BenchmarkStage.Download -> R.string.benchmark_stage_download
+    BenchmarkStage.Upload -> R.string.benchmark_stage_upload
+    BenchmarkStage.Udp -> R.string.benchmark_stage_udp
+}
+
+private fun formatMs(value: Double): String = "%.1f ms".format(value)
+
 @Composable
 fun StatRow(label: String, value: String) {
     Row(
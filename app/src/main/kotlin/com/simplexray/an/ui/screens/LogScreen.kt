@@ -1,5 +1,6 @@
 package com.simplexray.an.ui.screens
 
+import androidx.compose.foundation.clickable
 import androidx.compose.foundation.layout.Box
 import androidx.compose.foundation.layout.Column
 import androidx.compose.foundation.layout.fillMaxSize
@@ -13,6 +14,7 @@ import androidx.compose.material3.Text
 import androidx.compose.runtime.Composable
 import androidx.compose.runtime.DisposableEffect
 import androidx.compose.runtime.LaunchedEffect
+import androidx.compose.runtime.derivedStateOf
 import androidx.compose.runtime.getValue
 import androidx.compose.runtime.mutableStateOf
 import androidx.compose.runtime.remember
@@ -33,6 +35,8 @@ import com.simplexray.an.ui.theme.ScrollbarDefaults
 import com.simplexray.an.viewmodel.LogViewModel
 import my.nanihadesuka.compose.LazyColumnScrollbar
 
+private const val LOAD_OLDER_THRESHOLD = 50
+
 @OptIn(androidx.compose.material3.ExperimentalMaterial3Api::class)
 @Composable
 fun LogScreen(
@@ -51,6 +55,18 @@ fun LogScreen(
         }
     }
 
+    val nearOldestEntry by remember {
+        derivedStateOf {
+            val layoutInfo = listState.layoutInfo
+            val lastVisible = layoutInfo.visibleItemsInfo.lastOrNull()?.index ?: 0
+            lastVisible >= layoutInfo.totalItemsCount - LOAD_OLDER_THRESHOLD
+        }
+    }
+
+    LaunchedEffect(nearOldestEntry, filteredEntries.size) {
+        if (nearOldestEntry) logViewModel.loadOlderLogs()
+    }
+
     LaunchedEffect(filteredEntries) {
         if (filteredEntries.isNotEmpty() && isInitialLoad.value) {
             listState.animateScrollToItem(0)
@@ -84,7 +100,10 @@ fun LogScreen(
                     reverseLayout = true
                 ) {
                     items(filteredEntries) { logEntry ->
-                        LogEntryItem(logEntry = logEntry)
+                        LogEntryItem(
+                            logEntry = logEntry,
+                            onClick = { logViewModel.onConnectionFilterToggle(logEntry) }
+                        )
                     }
                 }
             }
@@ -93,7 +112,7 @@ fun LogScreen(
 }
 
 @Composable
-fun LogEntryItem(logEntry: String) {
+fun LogEntryItem(logEntry: String, onClick: () -> Unit) {
     val colorOnSurface = MaterialTheme.colorScheme.onSurface
     val timestampColor = MaterialTheme.colorScheme.primary
 
@@ -133,6 +152,9 @@ fun LogEntryItem(logEntry: String) {
         fontSize = 13.sp,
         fontFamily = FontFamily.Monospace,
         color = colorOnSurface,
-        modifier = Modifier.padding(vertical = 2.dp)
+        modifier = Modifier
+            .fillMaxWidth()
+            .clickable(onClick = onClick)
+            .padding(vertical = 2.dp)
     )
 }
@@ -383,6 +383,19 @@ fun SettingsScreen(
             scope = scope
         )
 
+        EditableListItemWithBottomSheet(
+            headline = stringResource(R.string.tunnel_mtu),
+            currentValue = settingsState.tunnelMtu.value,
+            onValueConfirmed = { newValue -> mainViewModel.updateTunnelMtu(newValue) },
+            label = stringResource(R.string.tunnel_mtu),
+            keyboardOptions = KeyboardOptions(keyboardType = KeyboardType.Number),
+            isError = !settingsState.tunnelMtu.isValid,
+            errorMessage = settingsState.tunnelMtu.error,
+            enabled = !vpnDisabled,
+            sheetState = sheetState,
+            scope = scope
+        )
+
         EditableListItemWithBottomSheet(
             headline = stringResource(R.string.dns_ipv4),
             currentValue = settingsState.dnsIpv4.value,
@@ -409,6 +422,33 @@ fun SettingsScreen(
             scope = scope
         )
 
+        ListItem(
+            headlineContent = { Text(stringResource(R.string.map_dns_title)) },
+            supportingContent = { Text(stringResource(R.string.map_dns_summary)) },
+            trailingContent = {
+                Switch(
+                    checked = settingsState.switches.mapDnsEnabled,
+                    onCheckedChange = {
+                        mainViewModel.setMapDnsEnabled(it)
+                    },
+                    enabled = !vpnDisabled
+                )
+            }
+        )
+
+        EditableListItemWithBottomSheet(
+            headline = stringResource(R.string.map_dns_cache_size),
+            currentValue = settingsState.mapDnsCacheSize.value,
+            onValueConfirmed = { newValue -> mainViewModel.updateMapDnsCacheSize(newValue) },
+            label = stringResource(R.string.map_dns_cache_size),
+            keyboardOptions = KeyboardOptions(keyboardType = KeyboardType.Number),
+            isError = !settingsState.mapDnsCacheSize.isValid,
+            errorMessage = settingsState.mapDnsCacheSize.error,
+            enabled = settingsState.switches.mapDnsEnabled && !vpnDisabled,
+            sheetState = sheetState,
+            scope = scope
+        )
+
         ListItem(
             headlineContent = { Text(stringResource(R.string.ipv6)) },
             supportingContent = { Text(stringResource(R.string.ipv6_enabled)) },
@@ -451,6 +491,99 @@ fun SettingsScreen(
             }
         )
 
+        ListItem(
+            headlineContent = { Text(stringResource(R.string.socks_pipeline_title)) },
+            supportingContent = { Text(stringResource(R.string.socks_pipeline_summary)) },
+            trailingContent = {
+                Switch(
+                    checked = settingsState.switches.socksPipelineEnabled,
+                    onCheckedChange = {
+                        mainViewModel.setSocksPipelineEnabled(it)
+                    },
+                    enabled = !vpnDisabled
+                )
+            }
+        )
+
+        ListItem(
+            headlineContent = { Text(stringResource(R.string.udp_in_tcp_title)) },
+            supportingContent = { Text(stringResource(R.string.udp_in_tcp_summary)) },
+            trailingContent = {
+                Switch(
+                    checked = settingsState.switches.udpInTcpEnabled,
+                    onCheckedChange = {
+                        mainViewModel.setUdpInTcpEnabled(it)
+                    },
+                    enabled = !vpnDisabled
+                )
+            }
+        )
+
+        EditableListItemWithBottomSheet(
+            headline = stringResource(R.string.udp_recv_buffer_size),
+            currentValue = settingsState.udpRecvBufferSize.value,
+            onValueConfirmed = { newValue -> mainViewModel.updateUdpRecvBufferSize(newValue) },
+            label = stringResource(R.string.udp_recv_buffer_size),
+            keyboardOptions = KeyboardOptions(keyboardType = KeyboardType.Number),
+            isError = !settingsState.udpRecvBufferSize.isValid,
+            errorMessage = settingsState.udpRecvBufferSize.error,
+            enabled = !vpnDisabled,
+            sheetState = sheetState,
+            scope = scope
+        )
+
+        EditableListItemWithBottomSheet(
+            headline = stringResource(R.string.tcp_buffer_size),
+            currentValue = settingsState.tcpBufferSize.value,
+            onValueConfirmed = { newValue -> mainViewModel.updateTcpBufferSize(newValue) },
+            label = stringResource(R.string.tcp_buffer_size),
+            keyboardOptions = KeyboardOptions(keyboardType = KeyboardType.Number),
+            isError = !settingsState.tcpBufferSize.isValid,
+            errorMessage = settingsState.tcpBufferSize.error,
+            enabled = !vpnDisabled,
+            sheetState = sheetState,
+            scope = scope
+        )
+
+        EditableListItemWithBottomSheet(
+            headline = stringResource(R.string.tcp_idle_timeout),
+            currentValue = settingsState.tcpIdleTimeout.value,
+            onValueConfirmed = { newValue -> mainViewModel.updateTcpIdleTimeout(newValue) },
+            label = stringResource(R.string.tcp_idle_timeout),
+            keyboardOptions = KeyboardOptions(keyboardType = KeyboardType.Number),
+            isError = !settingsState.tcpIdleTimeout.isValid,
+            errorMessage = settingsState.tcpIdleTimeout.error,
+            enabled = !vpnDisabled,
+            sheetState = sheetState,
+            scope = scope
+        )
+
+        EditableListItemWithBottomSheet(
+            headline = stringResource(R.string.udp_idle_timeout),
+            currentValue = settingsState.udpIdleTimeout.value,
+            onValueConfirmed = { newValue -> mainViewModel.updateUdpIdleTimeout(newValue) },
+            label = stringResource(R.string.udp_idle_timeout),
+            keyboardOptions = KeyboardOptions(keyboardType = KeyboardType.Number),
+            isError = !settingsState.udpIdleTimeout.isValid,
+            errorMessage = settingsState.udpIdleTimeout.error,
+            enabled = !vpnDisabled,
+            sheetState = sheetState,
+            scope = scope
+        )
+
+        EditableListItemWithBottomSheet(
+            headline = stringResource(R.string.udp_copy_buffer_nums),
+            currentValue = settingsState.udpCopyBufferNums.value,
+            onValueConfirmed = { newValue -> mainViewModel.updateUdpCopyBufferNums(newValue) },
+            label = stringResource(R.string.udp_copy_buffer_nums),
+            keyboardOptions = KeyboardOptions(keyboardType = KeyboardType.Number),
+            isError = !settingsState.udpCopyBufferNums.isValid,
+            errorMessage = settingsState.udpCopyBufferNums.error,
+            enabled = !vpnDisabled,
+            sheetState = sheetState,
+            scope = scope
+        )
+
         PreferenceCategoryTitle(stringResource(R.string.rule_files_category_title))
 
         ListItem(
@@ -567,6 +700,40 @@ fun SettingsScreen(
             scope = scope
         )
 
+        ListItem(
+            headlineContent = { Text(stringResource(R.string.auto_select_config_title)) },
+            supportingContent = { Text(stringResource(R.string.auto_select_config_summary)) },
+            trailingContent = {
+                Switch(
+                    checked = settingsState.switches.autoSelectConfig,
+                    onCheckedChange = {
+                        mainViewModel.setAutoSelectConfigEnabled(it)
+                    }
+                )
+            }
+        )
+
+        ListItem(
+            headlineContent = { Text(stringResource(R.string.service_tracing_title)) },
+            supportingContent = { Text(stringResource(R.string.service_tracing_summary)) },
+            trailingContent = {
+                Switch(
+                    checked = settingsState.switches.serviceTracing,
+                    onCheckedChange = {
+                        mainViewModel.setServiceTracingEnabled(it)
+                    }
+                )
+            }
+        )
+
+        ListItem(
+            modifier = Modifier.clickable(enabled = settingsState.switches.serviceTracing) {
+                mainViewModel.exportServiceTrace()
+            },
+            headlineContent = { Text(stringResource(R.string.service_trace_export_title)) },
+            supportingContent = { Text(stringResource(R.string.service_trace_export_summary)) }
+        )
+
         PreferenceCategoryTitle(stringResource(R.string.about))
 
         ListItem(
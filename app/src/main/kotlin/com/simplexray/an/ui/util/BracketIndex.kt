@@ -0,0 +1,201 @@
+package com.simplexray.an.ui.util
+
+/**
+ * Positions of the structural brackets and quotes of a JSON document, i.e. the ones outside
+ * strings and not escaped. Kept in sync with the editor by [update], which only rescans from the
+ * last quote before an edit up to the first quote after it whose string state is unchanged;
+ * an edit without brackets, quotes or backslashes just shifts the positions after it, lazily.
+ * Finding the edit is a scan of the common prefix and suffix, so O(n) per keystroke unless the
+ * caller bounds it with the unchanged ends it knows of. Matching pairs are resolved on demand.
+ */
+internal class BracketIndex {
+    private var text: String = ""
+    private var positions = IntArray(0)
+    private var kinds = CharArray(0)
+    private var size = 0
+
+    /** Tokens from [shiftFrom] on are [shiftDelta] ahead of what [positions] says. */
+    private var shiftFrom = 0
+    private var shiftDelta = 0
+
+    private var partners: IntArray? = null
+
+    /**
+     * [unchangedPrefix] and [unchangedSuffix] are how many leading and trailing chars the caller
+     * knows to be the same in both texts; the diff starts from there instead of from the ends.
+     */
+    fun update(newText: String, unchangedPrefix: Int = 0, unchangedSuffix: Int = 0) {
+        val oldText = text
+        if (newText === oldText) return
+        text = newText
+
+        val minLength = minOf(oldText.length, newText.length)
+        var prefix = unchangedPrefix.coerceIn(0, minLength)
+        while (prefix < minLength && oldText[prefix] == newText[prefix]) prefix++
+        if (prefix == oldText.length && prefix == newText.length) return
+        var suffix = unchangedSuffix.coerceIn(0, minLength - prefix)
+        while (suffix < minLength - prefix &&
+            oldText[oldText.length - 1 - suffix] == newText[newText.length - 1 - suffix]
+        ) suffix++
+
+        val oldEnd = oldText.length - suffix
+        val newEnd = newText.length - suffix
+        val structural = (prefix > 0 && oldText[prefix - 1] == '\\') ||
+                hasSpecial(oldText, prefix, oldEnd) || hasSpecial(newText, prefix, newEnd)
+        if (structural) {
+            rescan(prefix, newEnd, newEnd - oldEnd)
+        } else {
+            shift(firstTokenAtOrAfter(oldEnd), newEnd - oldEnd)
+        }
+    }
+
+    /** The matching pair for a bracket just before or at [cursor], as in the editor's caret. */
+    fun matchAt(cursor: Int): Pair<Int, Int>? {
+        val index = bracketTokenAt(cursor - 1) ?: bracketTokenAt(cursor) ?: return null
+        val partner = resolvePartners()[index]
+        if (partner < 0) return null
+        val a = positionAt(index)
+        val b = positionAt(partner)
+        return if (a < b) a to b else b to a
+    }
+
+    private fun bracketTokenAt(position: Int): Int? {
+        if (position < 0) return null
+        val index = firstTokenAtOrAfter(position)
+        if (index >= size || positionAt(index) != position || kinds[index] == '"') return null
+        return index
+    }
+
+    /**
+     * Replaces the tokens from the last quote before the edit up to where the new scan lines up
+     * with the old tokens again: past the edit, at a quote the old index also had, entered with
+     * the same string state. Everything after that is the old index shifted by [delta].
+     */
+    private fun rescan(start: Int, newEnd: Int, delta: Int) {
+        materializeShift()
+        var checkpoint = firstTokenAtOrAfter(start) - 1
+        while (checkpoint >= 0 && kinds[checkpoint] != '"') checkpoint--
+        var quotes = 0
+        for (i in 0..checkpoint) if (kinds[i] == '"') quotes++
+        val scanFrom = if (checkpoint >= 0) positions[checkpoint] + 1 else 0
+
+        var scannedPositions = IntArray(16)
+        var scannedKinds = CharArray(16)
+        var scanned = 0
+        var resumeAt = size
+        var inString = quotes % 2 == 1
+        var oldIndex = checkpoint + 1
+        var oldInString = inString
+        var i = scanFrom
+        while (i < text.length) {
+            val c = text[i]
+            if (c == '\\') {
+                i += 2
+                continue
+            }
+            if (c == '"' && i >= newEnd) {
+                val oldPosition = i - delta
+                while (oldIndex < size && positions[oldIndex] < oldPosition) {
+                    if (kinds[oldIndex] == '"') oldInString = !oldInString
+                    oldIndex++
+                }
+                if (oldIndex < size && positions[oldIndex] == oldPosition &&
+                    kinds[oldIndex] == '"' && oldInString == inString
+                ) {
+                    resumeAt = oldIndex
+                    break
+                }
+            }
+            if (c == '"' || (!inString && (c == '{' || c == '}' || c == '[' || c == ']'))) {
+                if (scanned == scannedPositions.size) {
+                    scannedPositions = scannedPositions.copyOf(scanned * 2)
+                    scannedKinds = scannedKinds.copyOf(scanned * 2)
+                }
+                scannedPositions[scanned] = i
+                scannedKinds[scanned] = c
+                scanned++
+                if (c == '"') inString = !inString
+            }
+            i++
+        }
+
+        val keep = checkpoint + 1
+        val tail = size - resumeAt
+        val total = keep + scanned + tail
+        val resultPositions = IntArray(maxOf(total, 16))
+        val resultKinds = CharArray(resultPositions.size)
+        positions.copyInto(resultPositions, 0, 0, keep)
+        kinds.copyInto(resultKinds, 0, 0, keep)
+        scannedPositions.copyInto(resultPositions, keep, 0, scanned)
+        scannedKinds.copyInto(resultKinds, keep, 0, scanned)
+        for (t in 0 until tail) {
+            resultPositions[keep + scanned + t] = positions[resumeAt + t] + delta
+        }
+        kinds.copyInto(resultKinds, keep + scanned, resumeAt, size)
+        positions = resultPositions
+        kinds = resultKinds
+        size = total
+        partners = null
+    }
+
+    private fun resolvePartners(): IntArray {
+        partners?.let { return it }
+        val result = IntArray(size) { -1 }
+        val braces = ArrayList<Int>()
+        val squares = ArrayList<Int>()
+        for (i in 0 until size) {
+            when (kinds[i]) {
+                '{' -> braces.add(i)
+                '[' -> squares.add(i)
+                '}' -> if (braces.isNotEmpty()) pair(result, braces.removeAt(braces.size - 1), i)
+                ']' -> if (squares.isNotEmpty()) pair(result, squares.removeAt(squares.size - 1), i)
+            }
+        }
+        partners = result
+        return result
+    }
+
+    private fun pair(result: IntArray, open: Int, close: Int) {
+        result[open] = close
+        result[close] = open
+    }
+
+    private fun positionAt(index: Int): Int =
+        positions[index] + if (index >= shiftFrom) shiftDelta else 0
+
+    private fun firstTokenAtOrAfter(position: Int): Int {
+        var low = 0
+        var high = size
+        while (low < high) {
+            val mid = (low + high) ushr 1
+            if (positionAt(mid) < position) low = mid + 1 else high = mid
+        }
+        return low
+    }
+
+    private fun shift(from: Int, delta: Int) {
+        if (delta == 0 || from >= size) return
+        if (shiftDelta != 0 && shiftFrom != from) materializeShift()
+        shiftFrom = from
+        shiftDelta += delta
+    }
+
+    private fun materializeShift() {
+        if (shiftDelta != 0) {
+            for (i in shiftFrom until size) positions[i] += shiftDelta
+        }
+        shiftFrom = 0
+        shiftDelta = 0
+    }
+
+    companion object {
+        private fun hasSpecial(text: String, start: Int, end: Int): Boolean {
+            for (i in start until end) {
+                when (text[i]) {
+                    '{', '}', '[', ']', '"', '\\' -> return true
+                }
+            }
+            return false
+        }
+    }
+}
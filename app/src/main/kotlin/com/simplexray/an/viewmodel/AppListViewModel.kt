@@ -1,13 +1,16 @@
 package com.simplexray.an.viewmodel
 
-import android.Manifest
 import android.app.Application
 import android.content.ClipData
 import android.content.ClipboardManager
 import android.content.Context
-import android.content.pm.ApplicationInfo
 import android.content.pm.PackageManager
+import android.graphics.Bitmap
+import android.graphics.Canvas
+import android.graphics.drawable.BitmapDrawable
 import android.graphics.drawable.Drawable
+import android.util.LruCache
+import android.util.SparseLongArray
 import androidx.compose.runtime.derivedStateOf
 import androidx.compose.runtime.getValue
 import androidx.compose.runtime.mutableStateListOf
@@ -17,12 +20,16 @@ import androidx.lifecycle.AndroidViewModel
 import androidx.lifecycle.viewModelScope
 import com.simplexray.an.BuildConfig
 import com.simplexray.an.R
+import com.simplexray.an.common.AppTrafficMonitor
+import com.simplexray.an.data.source.PackageMetadataCache
 import com.simplexray.an.prefs.Preferences
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.channels.Channel
 import kotlinx.coroutines.delay
 import kotlinx.coroutines.flow.receiveAsFlow
 import kotlinx.coroutines.launch
+import kotlinx.coroutines.sync.Semaphore
+import kotlinx.coroutines.sync.withPermit
 import kotlinx.coroutines.withContext
 import java.util.Locale
 
@@ -33,11 +40,37 @@ sealed class AppListViewUiEvent {
 data class Package(
     var selected: Boolean,
     val label: String,
-    val icon: Drawable,
     val packageName: String,
-    val isSystemApp: Boolean
+    val isSystemApp: Boolean,
+    val uid: Int
 )
 
+/**
+ * Lowercased labels in list order. A query that extends the previous one only rescans the
+ * previous matches, so typing a word costs one full pass rather than one per keystroke.
+ */
+private class AppSearchIndex {
+    private var labels: Array<String> = emptyArray()
+    private var lastQuery = ""
+    private var lastMatches = IntArray(0)
+
+    fun rebuild(packages: List<Package>) {
+        val locale = Locale.getDefault()
+        labels = Array(packages.size) { packages[it].label.lowercase(locale) }
+        lastQuery = ""
+        lastMatches = IntArray(labels.size) { it }
+    }
+
+    fun matches(query: String): IntArray {
+        if (query == lastQuery) return lastMatches
+        val candidates = if (query.startsWith(lastQuery)) lastMatches
+        else IntArray(labels.size) { it }
+        lastMatches = candidates.filter { labels[it].contains(query) }.toIntArray()
+        lastQuery = query
+        return lastMatches
+    }
+}
+
 class AppListViewModel(application: Application) : AndroidViewModel(application) {
     val prefs = Preferences(getApplication<Application>().applicationContext)
     private val packageList = mutableStateListOf<Package>()
@@ -46,16 +79,30 @@ class AppListViewModel(application: Application) : AndroidViewModel(application)
     var showSystemApps by mutableStateOf(true)
     var bypassSelectedApps by mutableStateOf(prefs.bypassSelectedApps)
     private var _isChanged by mutableStateOf(false)
+    var showTraffic by mutableStateOf(false)
+    var trafficRates by mutableStateOf(SparseLongArray())
+        private set
+    private val trafficMonitor = AppTrafficMonitor(application)
 
     private val _uiEvent = Channel<AppListViewUiEvent>(Channel.BUFFERED)
     val uiEvent = _uiEvent.receiveAsFlow()
 
+    private val metadataCache = PackageMetadataCache(application)
+    private val searchIndex = AppSearchIndex()
+    private val iconCache = object : LruCache<String, Bitmap>(ICON_CACHE_BYTES) {
+        override fun sizeOf(key: String, value: Bitmap) = value.byteCount
+    }
+    private val iconLoadPermits = Semaphore(ICON_LOAD_PARALLELISM)
+
     val filteredList by derivedStateOf {
-        packageList.filter { pkg ->
-            (showSystemApps || !pkg.isSystemApp) &&
-                    pkg.label.lowercase(Locale.getDefault())
-                        .contains(searchQuery.lowercase(Locale.getDefault()))
-        }
+        val query = searchQuery.lowercase(Locale.getDefault())
+        val size = packageList.size
+        searchIndex.matches(query)
+            .asSequence()
+            .filter { it < size }
+            .map { packageList[it] }
+            .filter { showSystemApps || !it.isSystemApp }
+            .toList()
     }
 
     init {
@@ -64,34 +111,24 @@ class AppListViewModel(application: Application) : AndroidViewModel(application)
 
     private fun loadAppList() {
         isLoading = true
-        val pm = getApplication<Application>().packageManager
         val appPackageName = getApplication<Application>().packageName
         val apps = prefs.apps ?: emptySet()
-        var loadedPackages = pm.getInstalledPackages(PackageManager.GET_PERMISSIONS)
         val startTime = System.currentTimeMillis()
         viewModelScope.launch(Dispatchers.IO) {
-            while ((loadedPackages.isEmpty() || loadedPackages.size == 1)
-                && System.currentTimeMillis() - startTime < 10000
-            ) {
-                loadedPackages = pm.getInstalledPackages(PackageManager.GET_PERMISSIONS)
+            var entries = metadataCache.refresh()
+            while (entries.size <= 1 && System.currentTimeMillis() - startTime < 10000) {
                 delay(500)
+                entries = metadataCache.refresh()
             }
-            val list = loadedPackages.asSequence()
-                .mapNotNull {
-                    if (it.packageName == appPackageName) return@mapNotNull null
-                    val appInfo = it.applicationInfo ?: return@mapNotNull null
-                    val hasInternetPermission =
-                        it.requestedPermissions?.contains(Manifest.permission.INTERNET) == true
-                    if (!hasInternetPermission) return@mapNotNull null
-                    val isSystemApp = appInfo.flags and ApplicationInfo.FLAG_SYSTEM != 0
-                    val label = appInfo.loadLabel(pm).toString()
-                    val icon = appInfo.loadIcon(pm) ?: pm.defaultActivityIcon
+            val list = entries.asSequence()
+                .filter { it.packageName != appPackageName && it.hasInternetPermission }
+                .map {
                     Package(
                         selected = apps.contains(it.packageName),
-                        label = label,
-                        icon = icon,
+                        label = it.label,
                         packageName = it.packageName,
-                        isSystemApp = isSystemApp
+                        isSystemApp = it.isSystemApp,
+                        uid = it.uid
                     )
                 }
                 .sortedWith(
@@ -100,6 +137,7 @@ class AppListViewModel(application: Application) : AndroidViewModel(application)
                 )
                 .toList()
             withContext(Dispatchers.Main) {
+                searchIndex.rebuild(list)
                 packageList.clear()
                 packageList.addAll(list)
                 isLoading = false
@@ -107,6 +145,33 @@ class AppListViewModel(application: Application) : AndroidViewModel(application)
         }
     }
 
+    /** Icon for one row, rasterized at [sizePx]; rows load theirs as they scroll into view. */
+    suspend fun loadIcon(packageName: String, sizePx: Int): Bitmap? {
+        iconCache.get(packageName)?.let { return it }
+        return iconLoadPermits.withPermit {
+            withContext(Dispatchers.IO) {
+                iconCache.get(packageName) ?: try {
+                    val drawable = getApplication<Application>().packageManager
+                        .getApplicationIcon(packageName)
+                    drawableToBitmap(drawable, sizePx).also { iconCache.put(packageName, it) }
+                } catch (e: PackageManager.NameNotFoundException) {
+                    null
+                }
+            }
+        }
+    }
+
+    private fun drawableToBitmap(drawable: Drawable, sizePx: Int): Bitmap {
+        if (drawable is BitmapDrawable && drawable.bitmap.width <= sizePx) {
+            return drawable.bitmap
+        }
+        val bitmap = Bitmap.createBitmap(sizePx, sizePx, Bitmap.Config.ARGB_8888)
+        val canvas = Canvas(bitmap)
+        drawable.setBounds(0, 0, sizePx, sizePx)
+        drawable.draw(canvas)
+        return bitmap
+    }
+
     fun onPackageSelected(pkg: Package, isSelected: Boolean) {
         val index = packageList.indexOf(pkg)
         if (index != -1) {
@@ -125,6 +190,18 @@ class AppListViewModel(application: Application) : AndroidViewModel(application)
         showSystemApps = show
     }
 
+    fun hasUsageAccess(): Boolean = trafficMonitor.hasUsageAccess()
+
+    fun onShowTrafficChange(show: Boolean) {
+        showTraffic = show
+        if (!show) trafficRates = SparseLongArray()
+    }
+
+    suspend fun refreshTraffic() {
+        val rates = withContext(Dispatchers.IO) { trafficMonitor.sampleRates() }
+        trafficRates = rates
+    }
+
     fun onBypassSelectedAppsChange(bypass: Boolean) {
         bypassSelectedApps = bypass
         prefs.bypassSelectedApps = bypass
@@ -211,4 +288,9 @@ class AppListViewModel(application: Application) : AndroidViewModel(application)
         }
         saveChanges()
     }
+
+    companion object {
+        private const val ICON_CACHE_BYTES = 8 * 1024 * 1024
+        private const val ICON_LOAD_PARALLELISM = 4
+    }
 }
@@ -17,5 +17,18 @@ data class CoreStatsState(
     val frees: Long = 0,
     val liveObjects: Long = 0,
     val pauseTotalNs: Long = 0,
-    val uptime: Int = 0
+    val uptime: Int = 0,
+    val tunnelTxPackets: Long = 0,
+    val tunnelTxBytes: Long = 0,
+    val tunnelRxPackets: Long = 0,
+    val tunnelRxBytes: Long = 0,
+    val tunnelTcpBufferSize: Int = 0,
+    val tunnelMaxSessions: Int = 0,
+    val tunnelTaskStackSize: Int = 0,
+    val tunnelMemoryBudget: Long = 0,
+    val tunnelResidentBytes: Long = 0,
+    val uplinkRate: Long = 0,
+    val downlinkRate: Long = 0,
+    val tunnelTxRate: Long = 0,
+    val tunnelRxRate: Long = 0
 )
\ No newline at end of file
@@ -11,26 +11,36 @@ import androidx.lifecycle.AndroidViewModel
 import androidx.lifecycle.ViewModel
 import androidx.lifecycle.ViewModelProvider
 import androidx.lifecycle.viewModelScope
+import com.simplexray.an.common.log.LogLevel
+import com.simplexray.an.common.log.LogSearchIndex
+import com.simplexray.an.common.log.SearchResult
+import com.simplexray.an.data.source.LogChunk
 import com.simplexray.an.data.source.LogFileManager
 import com.simplexray.an.service.TProxyService
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.ExperimentalCoroutinesApi
 import kotlinx.coroutines.FlowPreview
+import kotlinx.coroutines.currentCoroutineContext
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.flow.asStateFlow
 import kotlinx.coroutines.flow.combine
 import kotlinx.coroutines.flow.debounce
+import kotlinx.coroutines.flow.filterNotNull
 import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.flow.mapLatest
+import kotlinx.coroutines.isActive
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.sync.Mutex
 import kotlinx.coroutines.sync.withLock
 import kotlinx.coroutines.withContext
 import java.io.File
-import java.util.Collections
 
 private const val TAG = "LogViewModel"
+private const val TAIL_LINES = 2000
+private const val PAGE_LINES = 1000
 
-@OptIn(FlowPreview::class)
+@OptIn(FlowPreview::class, ExperimentalCoroutinesApi::class)
 class LogViewModel(application: Application) :
     AndroidViewModel(application) {
 
@@ -41,18 +51,48 @@ class LogViewModel(application: Application) :
     private val _searchQuery = MutableStateFlow("")
     val searchQuery: StateFlow<String> = _searchQuery.asStateFlow()
 
+    private val _levelFilter = MutableStateFlow<LogLevel?>(null)
+    val levelFilter: StateFlow<LogLevel?> = _levelFilter.asStateFlow()
+
+    private val _connectionFilter = MutableStateFlow<Int?>(null)
+    val connectionFilter: StateFlow<Int?> = _connectionFilter.asStateFlow()
+
     private val _filteredEntries = MutableStateFlow<List<String>>(emptyList())
     val filteredEntries: StateFlow<List<String>> = _filteredEntries.asStateFlow()
 
+    private val searchIndex = LogSearchIndex()
+
+    @Volatile
+    private var lastSearchResult: SearchResult? = null
+
     fun onSearchQueryChange(query: String) {
         _searchQuery.value = query
     }
 
+    fun onLevelFilterChange(level: LogLevel?) {
+        _levelFilter.value = level
+    }
+
+    /**
+     * Toggles filtering by the connection of the tapped [line]; lines without one clear the filter.
+     */
+    fun onConnectionFilterToggle(line: String) {
+        val connectionId = LogSearchIndex.parseConnectionId(line)
+        _connectionFilter.value =
+            if (connectionId == null || connectionId == _connectionFilter.value) null else connectionId
+    }
+
+    fun clearConnectionFilter() {
+        _connectionFilter.value = null
+    }
+
     private val _hasLogsToExport = MutableStateFlow(false)
     val hasLogsToExport: StateFlow<Boolean> = _hasLogsToExport.asStateFlow()
 
-    private val logEntrySet: MutableSet<String> = Collections.synchronizedSet(HashSet())
     private val logMutex = Mutex()
+    private var readOffset = 0L
+    private var oldestOffset = 0L
+    private var hasOlderLogs = false
 
     private var logUpdateReceiver: BroadcastReceiver
 
@@ -61,34 +101,40 @@ class LogViewModel(application: Application) :
         logUpdateReceiver = object : BroadcastReceiver() {
             override fun onReceive(context: Context, intent: Intent) {
                 if (TProxyService.ACTION_LOG_UPDATE == intent.action) {
-                    val newLogs = intent.getStringArrayListExtra(TProxyService.EXTRA_LOG_DATA)
-                    if (!newLogs.isNullOrEmpty()) {
-                        Log.d(TAG, "Received log update broadcast with ${newLogs.size} entries.")
-                        viewModelScope.launch {
-                            processNewLogs(newLogs)
-                        }
-                    } else {
-                        Log.w(
-                            TAG,
-                            "Received log update broadcast, but log data list is null or empty."
-                        )
+                    viewModelScope.launch(Dispatchers.IO) {
+                        readNewLogs()
                     }
                 }
             }
         }
         viewModelScope.launch {
             logEntries.collect { entries ->
-                _hasLogsToExport.value = entries.isNotEmpty() && logFileManager.logFile.exists()
+                _hasLogsToExport.value = entries.isNotEmpty()
             }
         }
         viewModelScope.launch {
             combine(
                 logEntries,
-                searchQuery.debounce(200)
-            ) { logs, query ->
-                if (query.isBlank()) logs
-                else logs.filter { it.contains(query, ignoreCase = true) }
-            }
+                searchQuery.debounce(200),
+                levelFilter,
+                connectionFilter
+            ) { logs, query, level, connectionId -> LogFilterRequest(logs, query, level, connectionId) }
+                .mapLatest { (logs, query, level, connectionId) ->
+                    if (query.isBlank() && level == null && connectionId == null) {
+                        lastSearchResult = null
+                        return@mapLatest logs
+                    }
+                    val context = currentCoroutineContext()
+                    val result = searchIndex.search(
+                        if (query.isBlank()) "" else query,
+                        level,
+                        connectionId,
+                        lastSearchResult
+                    ) { !context.isActive } ?: return@mapLatest null
+                    lastSearchResult = result
+                    searchIndex.lines(result)
+                }
+                .filterNotNull()
                 .flowOn(Dispatchers.Default)
                 .collect { _filteredEntries.value = it }
         }
@@ -113,51 +159,78 @@ class LogViewModel(application: Application) :
     fun loadLogs() {
         viewModelScope.launch(Dispatchers.IO) {
             Log.d(TAG, "Loading logs.")
-            val savedLogData = logFileManager.readLogs()
-            val initialLogs = if (!savedLogData.isNullOrEmpty()) {
-                savedLogData.split("\n").filter { it.trim().isNotEmpty() }
-            } else {
-                emptyList()
+            val chunk = logFileManager.readTail(TAIL_LINES) ?: return@launch
+            logMutex.withLock {
+                applyReset(chunk)
             }
-            processInitialLogs(initialLogs)
+            Log.d(TAG, "Loaded ${chunk.lines.size} log entries.")
         }
     }
 
-    private suspend fun processInitialLogs(initialLogs: List<String>) {
+    private suspend fun readNewLogs() {
         logMutex.withLock {
-            logEntrySet.clear()
-            _logEntries.value = initialLogs.filter { logEntrySet.add(it) }.reversed()
+            val chunk = logFileManager.readLogsFrom(readOffset, TAIL_LINES) ?: return
+            if (chunk.reset) {
+                applyReset(chunk)
+                Log.d(TAG, "Log was rotated past our offset, reloaded ${chunk.lines.size} entries.")
+                return
+            }
+            readOffset = chunk.endOffset
+            if (chunk.lines.isNotEmpty()) {
+                searchIndex.appendNewer(chunk.lines)
+                _logEntries.value = searchIndex.lines()
+                Log.d(TAG, "Added ${chunk.lines.size} new log entries.")
+            }
         }
-        Log.d(TAG, "Processed initial logs: ${_logEntries.value.size} unique entries.")
     }
 
-    private suspend fun processNewLogs(newLogs: ArrayList<String>) {
-        val uniqueNewLogs = logMutex.withLock {
-            newLogs.filter { it.trim().isNotEmpty() && logEntrySet.add(it) }
-        }
-        if (uniqueNewLogs.isNotEmpty()) {
-            withContext(Dispatchers.Main) {
-                _logEntries.value = uniqueNewLogs + _logEntries.value
+    fun loadOlderLogs() {
+        if (!hasOlderLogs) return
+        viewModelScope.launch(Dispatchers.IO) {
+            logMutex.withLock {
+                if (!hasOlderLogs) return@launch
+                val chunk = logFileManager.readBefore(oldestOffset, PAGE_LINES) ?: return@launch
+                oldestOffset = chunk.startOffset
+                hasOlderLogs = chunk.lines.isNotEmpty()
+                if (chunk.lines.isNotEmpty()) {
+                    searchIndex.appendOlder(chunk.lines)
+                    _logEntries.value = searchIndex.lines()
+                    Log.d(TAG, "Paged in ${chunk.lines.size} older log entries.")
+                }
             }
-            Log.d(TAG, "Added ${uniqueNewLogs.size} new unique log entries.")
-        } else {
-            Log.d(TAG, "No unique log entries from broadcast to add.")
         }
     }
 
+    private fun applyReset(chunk: LogChunk) {
+        readOffset = chunk.endOffset
+        oldestOffset = chunk.startOffset
+        hasOlderLogs = chunk.lines.isNotEmpty()
+        searchIndex.clear()
+        searchIndex.appendNewer(chunk.lines)
+        _logEntries.value = searchIndex.lines()
+    }
+
     fun clearLogs() {
         viewModelScope.launch {
             logMutex.withLock {
                 _logEntries.value = emptyList()
-                logEntrySet.clear()
+                hasOlderLogs = false
+                searchIndex.clear()
             }
             Log.d(TAG, "Logs cleared.")
         }
     }
 
-    fun getLogFile(): File {
-        return logFileManager.logFile
+    suspend fun exportLogFile(): File? = withContext(Dispatchers.IO) {
+        logFileManager.exportLogs()
     }
+
+    private data class LogFilterRequest(
+        val logs: List<String>,
+        val query: String,
+        val level: LogLevel?,
+        val connectionId: Int?
+    )
 }
 
 class LogViewModelFactory(
@@ -12,6 +12,7 @@ import android.net.VpnService
 import android.os.Build
 import android.util.Log
 import androidx.activity.result.ActivityResultLauncher
+import androidx.core.content.FileProvider
 import androidx.lifecycle.AndroidViewModel
 import androidx.lifecycle.ViewModel
 import androidx.lifecycle.ViewModelProvider
@@ -19,9 +20,15 @@ import androidx.lifecycle.application
 import androidx.lifecycle.viewModelScope
 import com.simplexray.an.BuildConfig
 import com.simplexray.an.R
-import com.simplexray.an.common.CoreStatsClient
+import com.google.gson.GsonBuilder
+import com.simplexray.an.common.BenchmarkState
+import com.simplexray.an.common.ConfigLatency
+import com.simplexray.an.common.ConfigLatencyTester
+import com.simplexray.an.common.MetricsAggregator
+import com.simplexray.an.common.ProxyBenchmark
 import com.simplexray.an.common.ROUTE_APP_LIST
 import com.simplexray.an.common.ROUTE_CONFIG_EDIT
+import com.simplexray.an.common.TcpBufferSizing
 import com.simplexray.an.common.ThemeMode
 import com.simplexray.an.data.source.FileManager
 import com.simplexray.an.prefs.Preferences
@@ -35,7 +42,9 @@ import kotlinx.coroutines.ensureActive
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.flow.asStateFlow
+import kotlinx.coroutines.flow.collectLatest
 import kotlinx.coroutines.flow.receiveAsFlow
+import kotlinx.coroutines.flow.update
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.suspendCancellableCoroutine
 import kotlinx.coroutines.withContext
@@ -48,6 +57,7 @@ import java.io.BufferedReader
 import java.io.File
 import java.io.IOException
 import java.io.InputStreamReader
+import java.net.HttpURLConnection.HTTP_NOT_MODIFIED
 import java.net.InetSocketAddress
 import java.net.Proxy
 import java.net.Socket
@@ -70,9 +80,8 @@ class MainViewModel(application: Application) :
     AndroidViewModel(application) {
     val prefs: Preferences = Preferences(application)
     private val activityScope: CoroutineScope = viewModelScope
-    private var compressedBackupData: ByteArray? = null
 
-    private var coreStatsClient: CoreStatsClient? = null
+    private var metricsAggregator: MetricsAggregator? = null
 
     private val fileManager: FileManager = FileManager(application, prefs)
 
@@ -91,7 +100,12 @@ class MainViewModel(application: Application) :
                 useTemplateEnabled = prefs.useTemplate,
                 httpProxyEnabled = prefs.httpProxyEnabled,
                 bypassLanEnabled = prefs.bypassLan,
+                socksPipelineEnabled = prefs.socksPipeline,
+                udpInTcpEnabled = prefs.udpInTcp,
+                mapDnsEnabled = prefs.mapDns,
                 disableVpn = prefs.disableVpn,
+                autoSelectConfig = prefs.autoSelectConfig,
+                serviceTracing = prefs.serviceTracing,
                 themeMode = prefs.theme
             ),
             info = InfoStates(
@@ -107,7 +121,14 @@ class MainViewModel(application: Application) :
                 isGeositeCustom = prefs.customGeositeImported
             ),
             connectivityTestTarget = InputFieldState(prefs.connectivityTestTarget),
-            connectivityTestTimeout = InputFieldState(prefs.connectivityTestTimeout.toString())
+            connectivityTestTimeout = InputFieldState(prefs.connectivityTestTimeout.toString()),
+            tunnelMtu = InputFieldState(prefs.tunnelMtu.toString()),
+            udpRecvBufferSize = InputFieldState(prefs.udpRecvBufferSize.toString()),
+            udpCopyBufferNums = InputFieldState(prefs.udpCopyBufferNums.toString()),
+            tcpBufferSize = InputFieldState(prefs.tcpBufferSize.toString()),
+            tcpIdleTimeout = InputFieldState(prefs.tcpIdleTimeout.toString()),
+            udpIdleTimeout = InputFieldState(prefs.udpIdleTimeout.toString()),
+            mapDnsCacheSize = InputFieldState(prefs.mapDnsCacheSize.toString())
         )
     )
     val settingsState: StateFlow<SettingsState> = _settingsState.asStateFlow()
@@ -144,9 +165,22 @@ class MainViewModel(application: Application) :
     private val _newVersionAvailable = MutableStateFlow<String?>(null)
     val newVersionAvailable: StateFlow<String?> = _newVersionAvailable.asStateFlow()
 
+    private val _benchmarkState = MutableStateFlow<BenchmarkState>(BenchmarkState.Idle)
+    val benchmarkState: StateFlow<BenchmarkState> = _benchmarkState.asStateFlow()
+    private var benchmarkJob: Job? = null
+
+    /** Latency test results by config; a null value is a config whose probe failed. */
+    private val _configLatencies = MutableStateFlow<Map<File, ConfigLatency?>>(emptyMap())
+    val configLatencies: StateFlow<Map<File, ConfigLatency?>> = _configLatencies.asStateFlow()
+
+    private val _isTestingLatencies = MutableStateFlow(false)
+    val isTestingLatencies: StateFlow<Boolean> = _isTestingLatencies.asStateFlow()
+
     private val startReceiver = object : BroadcastReceiver() {
         override fun onReceive(context: Context, intent: Intent) {
             Log.d(TAG, "Service started")
+            // The service picked the API port the stats client is about to read.
+            Preferences.invalidate()
             setServiceEnabled(true)
             setControlMenuClickable(true)
         }
@@ -158,8 +192,38 @@ class MainViewModel(application: Application) :
             setServiceEnabled(false)
             setControlMenuClickable(true)
             _coreStatsState.value = CoreStatsState()
-            coreStatsClient?.close()
-            coreStatsClient = null
+            metricsAggregator?.close()
+            metricsAggregator = null
+        }
+    }
+
+    private val configSelectedReceiver = object : BroadcastReceiver() {
+        override fun onReceive(context: Context, intent: Intent) {
+            Log.d(TAG, "Config switched by auto-select")
+            Preferences.invalidate()
+            _selectedConfigFile.value = prefs.selectedConfigPath?.let { File(it) }
+        }
+    }
+
+    private val traceDumpedReceiver = object : BroadcastReceiver() {
+        override fun onReceive(context: Context, intent: Intent) {
+            if (!intent.getBooleanExtra(TProxyService.EXTRA_SUCCESS, false)) {
+                showExportFailedSnackbar()
+                return
+            }
+            val file = File(application.filesDir, TProxyService.TRACE_FILE_NAME)
+            val uri = FileProvider.getUriForFile(
+                application,
+                "com.simplexray.an.fileprovider",
+                file
+            )
+            val shareIntent = Intent(Intent.ACTION_SEND)
+            shareIntent.setType("application/json")
+            shareIntent.putExtra(Intent.EXTRA_STREAM, uri)
+            shareIntent.addFlags(Intent.FLAG_GRANT_READ_URI_PERMISSION)
+            val chooserIntent =
+                Intent.createChooser(shareIntent, application.getString(R.string.export))
+            shareIntent(chooserIntent, application.packageManager)
         }
     }
 
@@ -184,7 +248,12 @@ class MainViewModel(application: Application) :
                 useTemplateEnabled = prefs.useTemplate,
                 httpProxyEnabled = prefs.httpProxyEnabled,
                 bypassLanEnabled = prefs.bypassLan,
+                socksPipelineEnabled = prefs.socksPipeline,
+                udpInTcpEnabled = prefs.udpInTcp,
+                mapDnsEnabled = prefs.mapDns,
                 disableVpn = prefs.disableVpn,
+                autoSelectConfig = prefs.autoSelectConfig,
+                serviceTracing = prefs.serviceTracing,
                 themeMode = prefs.theme
             ),
             info = _settingsState.value.info.copy(
@@ -199,18 +268,42 @@ class MainViewModel(application: Application) :
                 isGeositeCustom = prefs.customGeositeImported
             ),
             connectivityTestTarget = InputFieldState(prefs.connectivityTestTarget),
-            connectivityTestTimeout = InputFieldState(prefs.connectivityTestTimeout.toString())
+            connectivityTestTimeout = InputFieldState(prefs.connectivityTestTimeout.toString()),
+            tunnelMtu = InputFieldState(prefs.tunnelMtu.toString()),
+            udpRecvBufferSize = InputFieldState(prefs.udpRecvBufferSize.toString()),
+            udpCopyBufferNums = InputFieldState(prefs.udpCopyBufferNums.toString()),
+            tcpBufferSize = InputFieldState(prefs.tcpBufferSize.toString()),
+            tcpIdleTimeout = InputFieldState(prefs.tcpIdleTimeout.toString()),
+            udpIdleTimeout = InputFieldState(prefs.udpIdleTimeout.toString()),
+            mapDnsCacheSize = InputFieldState(prefs.mapDnsCacheSize.toString())
         )
     }
 
+    /**
+     * Probing the version means booting a whole Go runtime, so the result is cached until the
+     * binary itself changes, which only happens when the app is updated.
+     */
     private fun loadKernelVersion() {
         val libraryDir = TProxyService.getNativeLibraryDir(application)
         val xrayPath = "$libraryDir/libxray.so"
+        val xrayFile = File(xrayPath)
+        val binaryKey = "${xrayFile.length()}:${xrayFile.lastModified()}"
+        val cachedVersion = prefs.kernelVersion
+        if (cachedVersion != null && prefs.kernelVersionKey == binaryKey) {
+            _settingsState.value = _settingsState.value.copy(
+                info = _settingsState.value.info.copy(kernelVersion = cachedVersion)
+            )
+            return
+        }
         try {
             val process = Runtime.getRuntime().exec("$xrayPath -version")
             val reader = BufferedReader(InputStreamReader(process.inputStream))
             val firstLine = reader.readLine()
             process.destroy()
+            if (firstLine != null) {
+                prefs.kernelVersion = firstLine
+                prefs.kernelVersionKey = binaryKey
+            }
             _settingsState.value = _settingsState.value.copy(
                 info = _settingsState.value.info.copy(
                     kernelVersion = firstLine ?: "N/A"
@@ -235,43 +328,18 @@ class MainViewModel(application: Application) :
         prefs.enable = enabled
     }
 
-    fun clearCompressedBackupData() {
-        compressedBackupData = null
-    }
-
     fun performBackup(createFileLauncher: ActivityResultLauncher<String>) {
-        activityScope.launch {
-            compressedBackupData = fileManager.compressBackupData()
-            val filename = "simplexray_backup_" + System.currentTimeMillis() + ".dat"
-            withContext(Dispatchers.Main) {
-                createFileLauncher.launch(filename)
-            }
-        }
+        val filename = "simplexray_backup_" + System.currentTimeMillis() + ".dat"
+        createFileLauncher.launch(filename)
     }
 
     suspend fun handleBackupFileCreationResult(uri: Uri) {
         withContext(Dispatchers.IO) {
-            if (compressedBackupData != null) {
-                val dataToWrite: ByteArray = compressedBackupData as ByteArray
-                compressedBackupData = null
-                try {
-                    application.contentResolver.openOutputStream(uri).use { os ->
-                        if (os != null) {
-                            os.write(dataToWrite)
-                            Log.d(TAG, "Backup successful to: $uri")
-                            _uiEvent.trySend(MainViewUiEvent.ShowSnackbar(application.getString(R.string.backup_success)))
-                        } else {
-                            Log.e(TAG, "Failed to open output stream for backup URI: $uri")
-                            _uiEvent.trySend(MainViewUiEvent.ShowSnackbar(application.getString(R.string.backup_failed)))
-                        }
-                    }
-                } catch (e: IOException) {
-                    Log.e(TAG, "Error writing backup data to URI: $uri", e)
-                    _uiEvent.trySend(MainViewUiEvent.ShowSnackbar(application.getString(R.string.backup_failed)))
-                }
+            if (fileManager.writeBackup(uri)) {
+                Log.d(TAG, "Backup successful to: $uri")
+                _uiEvent.trySend(MainViewUiEvent.ShowSnackbar(application.getString(R.string.backup_success)))
             } else {
                 _uiEvent.trySend(MainViewUiEvent.ShowSnackbar(application.getString(R.string.backup_failed)))
-                Log.e(TAG, "Compressed backup data is null in launcher callback.")
             }
         }
     }
@@ -300,35 +368,15 @@ class MainViewModel(application: Application) :
         return filePath
     }
 
-    suspend fun updateCoreStats() {
-        if (!_isServiceEnabled.value) return
-        if (coreStatsClient == null)
-            coreStatsClient = CoreStatsClient.create("127.0.0.1", prefs.apiPort)
-
-        val stats = coreStatsClient?.getSystemStats()
-        val traffic = coreStatsClient?.getTraffic()
-
-        if (stats == null && traffic == null) {
-            coreStatsClient?.close()
-            coreStatsClient = null
-            return
+    suspend fun collectCoreStats() {
+        _isServiceEnabled.collectLatest { enabled ->
+            if (!enabled) return@collectLatest
+            val aggregator = metricsAggregator
+                ?: MetricsAggregator(application).also { metricsAggregator = it }
+            aggregator.updates(CORE_STATS_INTERVAL_MS).collect {
+                _coreStatsState.value = it
+            }
         }
-
-        _coreStatsState.value = CoreStatsState(
-            uplink = traffic?.uplink ?: 0,
-            downlink = traffic?.downlink ?: 0,
-            numGoroutine = stats?.numGoroutine ?: 0,
-            numGC = stats?.numGC ?: 0,
-            alloc = stats?.alloc ?: 0,
-            totalAlloc = stats?.totalAlloc ?: 0,
-            sys = stats?.sys ?: 0,
-            mallocs = stats?.mallocs ?: 0,
-            frees = stats?.frees ?: 0,
-            liveObjects = stats?.liveObjects ?: 0,
-            pauseTotalNs = stats?.pauseTotalNs ?: 0,
-            uptime = stats?.uptime ?: 0
-        )
-        Log.d(TAG, "Core stats updated")
     }
 
     suspend fun importConfigFromClipboard(): String? {
@@ -470,6 +518,36 @@ class MainViewModel(application: Application) :
         )
     }
 
+    fun setAutoSelectConfigEnabled(enabled: Boolean) {
+        prefs.autoSelectConfig = enabled
+        _settingsState.value = _settingsState.value.copy(
+            switches = _settingsState.value.switches.copy(autoSelectConfig = enabled)
+        )
+        notifyPeriodicSettingsChanged()
+    }
+
+    fun setServiceTracingEnabled(enabled: Boolean) {
+        prefs.serviceTracing = enabled
+        _settingsState.value = _settingsState.value.copy(
+            switches = _settingsState.value.switches.copy(serviceTracing = enabled)
+        )
+        notifyPeriodicSettingsChanged()
+    }
+
+    /** A core-only service stops its periodic loop while neither setting is on, so wake it. */
+    private fun notifyPeriodicSettingsChanged() {
+        if (_isServiceEnabled.value) startTProxyService(TProxyService.ACTION_PERIODIC_SETTINGS)
+    }
+
+    /** Asks the running service to dump its trace; [traceDumpedReceiver] shares the result. */
+    fun exportServiceTrace() {
+        if (!_isServiceEnabled.value) {
+            _uiEvent.trySend(MainViewUiEvent.ShowSnackbar(application.getString(R.string.service_trace_not_running)))
+            return
+        }
+        startTProxyService(TProxyService.ACTION_DUMP_TRACE)
+    }
+
     fun setBypassLanEnabled(enabled: Boolean) {
         prefs.bypassLan = enabled
         _settingsState.value = _settingsState.value.copy(
@@ -477,6 +555,27 @@ class MainViewModel(application: Application) :
         )
     }
 
+    fun setSocksPipelineEnabled(enabled: Boolean) {
+        prefs.socksPipeline = enabled
+        _settingsState.value = _settingsState.value.copy(
+            switches = _settingsState.value.switches.copy(socksPipelineEnabled = enabled)
+        )
+    }
+
+    fun setUdpInTcpEnabled(enabled: Boolean) {
+        prefs.udpInTcp = enabled
+        _settingsState.value = _settingsState.value.copy(
+            switches = _settingsState.value.switches.copy(udpInTcpEnabled = enabled)
+        )
+    }
+
+    fun setMapDnsEnabled(enabled: Boolean) {
+        prefs.mapDns = enabled
+        _settingsState.value = _settingsState.value.copy(
+            switches = _settingsState.value.switches.copy(mapDnsEnabled = enabled)
+        )
+    }
+
     fun setDisableVpnEnabled(enabled: Boolean) {
         prefs.disableVpn = enabled
         _settingsState.value = _settingsState.value.copy(
@@ -701,6 +800,152 @@ class MainViewModel(application: Application) :
         }
     }
 
+    fun updateTunnelMtu(mtuString: String): Boolean {
+        val mtu = mtuString.toIntOrNull()
+        return if (mtu != null && mtu in 1280..65535) {
+            prefs.tunnelMtu = mtu
+            _settingsState.value = _settingsState.value.copy(
+                tunnelMtu = InputFieldState(mtuString)
+            )
+            true
+        } else {
+            _settingsState.value = _settingsState.value.copy(
+                tunnelMtu = InputFieldState(
+                    value = mtuString,
+                    error = application.getString(R.string.invalid_mtu),
+                    isValid = false
+                )
+            )
+            false
+        }
+    }
+
+    fun updateUdpRecvBufferSize(sizeString: String): Boolean {
+        val size = sizeString.toIntOrNull()
+        return if (size != null && size in 4096..16777216) {
+            prefs.udpRecvBufferSize = size
+            _settingsState.value = _settingsState.value.copy(
+                udpRecvBufferSize = InputFieldState(sizeString)
+            )
+            true
+        } else {
+            _settingsState.value = _settingsState.value.copy(
+                udpRecvBufferSize = InputFieldState(
+                    value = sizeString,
+                    error = application.getString(R.string.invalid_value_range, 4096, 16777216),
+                    isValid = false
+                )
+            )
+            false
+        }
+    }
+
+    fun updateTcpBufferSize(sizeString: String): Boolean {
+        val size = sizeString.toIntOrNull()
+        return if (size != null && (size == TcpBufferSizing.ADAPTIVE ||
+                    size in TcpBufferSizing.MIN_SIZE..TcpBufferSizing.MAX_SIZE)
+        ) {
+            prefs.tcpBufferSize = size
+            _settingsState.value = _settingsState.value.copy(
+                tcpBufferSize = InputFieldState(sizeString)
+            )
+            true
+        } else {
+            _settingsState.value = _settingsState.value.copy(
+                tcpBufferSize = InputFieldState(
+                    value = sizeString,
+                    error = application.getString(
+                        R.string.invalid_value_range,
+                        TcpBufferSizing.MIN_SIZE,
+                        TcpBufferSizing.MAX_SIZE
+                    ),
+                    isValid = false
+                )
+            )
+            false
+        }
+    }
+
+    fun updateTcpIdleTimeout(timeoutString: String): Boolean {
+        val timeout = timeoutString.toIntOrNull()
+        return if (timeout != null && timeout in 10000..3600000) {
+            prefs.tcpIdleTimeout = timeout
+            _settingsState.value = _settingsState.value.copy(
+                tcpIdleTimeout = InputFieldState(timeoutString)
+            )
+            true
+        } else {
+            _settingsState.value = _settingsState.value.copy(
+                tcpIdleTimeout = InputFieldState(
+                    value = timeoutString,
+                    error = application.getString(R.string.invalid_value_range, 10000, 3600000),
+                    isValid = false
+                )
+            )
+            false
+        }
+    }
+
+    fun updateUdpIdleTimeout(timeoutString: String): Boolean {
+        val timeout = timeoutString.toIntOrNull()
+        return if (timeout != null && timeout in 5000..600000) {
+            prefs.udpIdleTimeout = timeout
+            _settingsState.value = _settingsState.value.copy(
+                udpIdleTimeout = InputFieldState(timeoutString)
+            )
+            true
+        } else {
+            _settingsState.value = _settingsState.value.copy(
+                udpIdleTimeout = InputFieldState(
+                    value = timeoutString,
+                    error = application.getString(R.string.invalid_value_range, 5000, 600000),
+                    isValid = false
+                )
+            )
+            false
+        }
+    }
+
+    fun updateUdpCopyBufferNums(numsString: String): Boolean {
+        val nums = numsString.toIntOrNull()
+        return if (nums != null && nums in 1..1024) {
+            prefs.udpCopyBufferNums = nums
+            _settingsState.value = _settingsState.value.copy(
+                udpCopyBufferNums = InputFieldState(numsString)
+            )
+            true
+        } else {
+            _settingsState.value = _settingsState.value.copy(
+                udpCopyBufferNums = InputFieldState(
+                    value = numsString,
+                    error = application.getString(R.string.invalid_value_range, 1, 1024),
+                    isValid = false
+                )
+            )
+            false
+        }
+    }
+
+    fun updateMapDnsCacheSize(sizeString: String): Boolean {
+        val size = sizeString.toIntOrNull()
+        return if (size != null && size in 100..1000000) {
+            prefs.mapDnsCacheSize = size
+            _settingsState.value = _settingsState.value.copy(
+                mapDnsCacheSize = InputFieldState(sizeString)
+            )
+            true
+        } else {
+            _settingsState.value = _settingsState.value.copy(
+                mapDnsCacheSize = InputFieldState(
+                    value = sizeString,
+                    error = application.getString(R.string.invalid_value_range, 100, 1000000),
+                    isValid = false
+                )
+            )
+            false
+        }
+    }
+
     fun testConnectivity() {
         viewModelScope.launch(Dispatchers.IO) {
             val prefs = prefs
@@ -768,6 +1013,124 @@ class MainViewModel(application: Application) :
         }
     }
 
+    /**
+     * Probes every config concurrently and, once all results are in, orders the list fastest
+     * first with failed configs last. The order is saved like a manual reorder.
+     */
+    fun testAllConfigLatencies() {
+        if (_isTestingLatencies.value) return
+        val target = try {
+            URL(prefs.connectivityTestTarget)
+        } catch (e: Exception) {
+            _uiEvent.trySend(MainViewUiEvent.ShowSnackbar(application.getString(R.string.connectivity_test_invalid_url)))
+            return
+        }
+        val libraryDir = TProxyService.getNativeLibraryDir(application) ?: return
+        val files = _configFiles.value
+        if (files.isEmpty()) return
+        val tester = ConfigLatencyTester(
+            xrayPath = "$libraryDir/libxray.so",
+            workingDir = application.filesDir,
+            targetUrl = target,
+            timeoutMs = prefs.connectivityTestTimeout
+        )
+        _isTestingLatencies.value = true
+        _configLatencies.value = emptyMap()
+        viewModelScope.launch {
+            try {
+                tester.testAll(files) { file, latency ->
+                    _configLatencies.update { it + (file to latency) }
+                    if (latency != null && file == _selectedConfigFile.value) {
+                        prefs.measuredRttMs = latency.firstByteMs.toInt()
+                    }
+                }
+                val results = _configLatencies.value
+                val sorted = _configFiles.value.sortedBy { results[it]?.totalMs ?: Long.MAX_VALUE }
+                _configFiles.value = sorted
+                prefs.configFilesOrder = sorted.map { it.name }
+            } finally {
+                _isTestingLatencies.value = false
+            }
+        }
+    }
+
+    fun runBenchmark() {
+        if (benchmarkJob?.isActive == true) return
+        val prefs = prefs
+        try {
+            URL(prefs.connectivityTestTarget)
+        } catch (e: Exception) {
+            _uiEvent.trySend(MainViewUiEvent.ShowSnackbar(application.getString(R.string.connectivity_test_invalid_url)))
+            return
+        }
+        val benchmark = ProxyBenchmark(
+            socksHost = prefs.socksAddress,
+            socksPort = prefs.socksPort,
+            socksUsername = prefs.socksUsername,
+            socksPassword = prefs.socksPassword,
+            targetUrl = prefs.connectivityTestTarget,
+            timeoutMs = prefs.connectivityTestTimeout
+        )
+        benchmarkJob = viewModelScope.launch {
+            try {
+                val report = benchmark.run(
+                    appVersion = BuildConfig.VERSION_NAME,
+                    config = _selectedConfigFile.value?.name
+                ) { stage -> _benchmarkState.value = BenchmarkState.Running(stage) }
+                report.udp?.let { prefs.measuredRttMs = it.p50Ms.toInt() }
+                report.download?.let { prefs.measuredBandwidth = it.bytesPerSecond }
+                _benchmarkState.value = BenchmarkState.Finished(report)
+            } catch (e: CancellationException) {
+                _benchmarkState.value = BenchmarkState.Idle
+                throw e
+            }
+        }
+    }
+
+    fun cancelBenchmark() {
+        benchmarkJob?.cancel()
+        benchmarkJob = null
+        _benchmarkState.value = BenchmarkState.Idle
+    }
+
+    fun dismissBenchmark() {
+        if (benchmarkJob?.isActive == true) return
+        _benchmarkState.value = BenchmarkState.Idle
+    }
+
+    /** Writes the last report as JSON under filesDir so it can go through the FileProvider. */
+    fun exportBenchmark() {
+        val report = (_benchmarkState.value as? BenchmarkState.Finished)?.report ?: return
+        viewModelScope.launch {
+            val file = withContext(Dispatchers.IO) {
+                try {
+                    File(application.filesDir, BENCHMARK_FILE_NAME).apply {
+                        writeText(GsonBuilder().setPrettyPrinting().create().toJson(report))
+                    }
+                } catch (e: IOException) {
+                    Log.e(TAG, "Failed to write benchmark report", e)
+                    null
+                }
+            }
+            if (file == null) {
+                showExportFailedSnackbar()
+                return@launch
+            }
+            val uri = FileProvider.getUriForFile(
+                application,
+                "com.simplexray.an.fileprovider",
+                file
+            )
+            val shareIntent = Intent(Intent.ACTION_SEND)
+            shareIntent.setType("application/json")
+            shareIntent.putExtra(Intent.EXTRA_STREAM, uri)
+            shareIntent.addFlags(Intent.FLAG_GRANT_READ_URI_PERMISSION)
+            val chooserIntent =
+                Intent.createChooser(shareIntent, application.getString(R.string.export))
+            shareIntent(chooserIntent, application.packageManager)
+        }
+    }
+
     fun registerTProxyServiceReceivers() {
         val application = application
         val startSuccessFilter = IntentFilter(TProxyService.ACTION_START)
@@ -793,6 +1156,30 @@ class MainViewModel(application: Application) :
             @Suppress("UnspecifiedRegisterReceiverFlag")
             application.registerReceiver(stopReceiver, stopSuccessFilter)
         }
+
+        val configSelectedFilter = IntentFilter(TProxyService.ACTION_CONFIG_SELECTED)
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.TIRAMISU) {
+            application.registerReceiver(
+                configSelectedReceiver,
+                configSelectedFilter,
+                Context.RECEIVER_NOT_EXPORTED
+            )
+        } else {
+            @Suppress("UnspecifiedRegisterReceiverFlag")
+            application.registerReceiver(configSelectedReceiver, configSelectedFilter)
+        }
+
+        val traceDumpedFilter = IntentFilter(TProxyService.ACTION_TRACE_DUMPED)
+        if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.TIRAMISU) {
+            application.registerReceiver(
+                traceDumpedReceiver,
+                traceDumpedFilter,
+                Context.RECEIVER_NOT_EXPORTED
+            )
+        } else {
+            @Suppress("UnspecifiedRegisterReceiverFlag")
+            application.registerReceiver(traceDumpedReceiver, traceDumpedFilter)
+        }
         Log.d(TAG, "TProxyService receivers registered.")
     }
 
@@ -800,6 +1187,8 @@ class MainViewModel(application: Application) :
         val application = application
         application.unregisterReceiver(startReceiver)
         application.unregisterReceiver(stopReceiver)
+        application.unregisterReceiver(configSelectedReceiver)
+        application.unregisterReceiver(traceDumpedReceiver)
         Log.d(TAG, "TProxyService receivers unregistered.")
     }
 
@@ -877,10 +1266,21 @@ class MainViewModel(application: Application) :
             try {
                 progressFlow.value = application.getString(R.string.connecting)
 
-                val request = Request.Builder().url(url).build()
+                val validators = fileManager.ruleFileValidators(fileName, url)
+                val request = Request.Builder().url(url).apply {
+                    validators?.first?.let { header("If-None-Match", it) }
+                    validators?.second?.let { header("If-Modified-Since", it) }
+                }.build()
                 val call = client.newCall(request)
                 val response = call.await()
 
+                if (response.code == HTTP_NOT_MODIFIED && validators != null) {
+                    response.close()
+                    Log.d(TAG, "$fileName is up to date")
+                    _uiEvent.trySend(MainViewUiEvent.ShowSnackbar(application.getString(R.string.rule_file_up_to_date)))
+                    return@launch
+                }
+
                 if (!response.isSuccessful) {
                     throw IOException("Failed to download file: ${response.code}")
                 }
@@ -891,7 +1291,13 @@ class MainViewModel(application: Application) :
                 var lastProgress = -1
 
                 body.byteStream().use { inputStream ->
-                    val success = fileManager.saveRuleFile(inputStream, fileName) { read ->
+                    val success = fileManager.saveRuleFile(
+                        inputStream,
+                        fileName,
+                        url,
+                        response.header("ETag"),
+                        response.header("Last-Modified")
+                    ) { read ->
                         ensureActive()
                         bytesRead += read
                         if (totalBytes > 0) {
@@ -1062,6 +1468,8 @@ class MainViewModel(application: Application) :
         private const val IPV6_REGEX =
             "^(([0-9a-fA-F]{1,4}:){7}[0-9a-fA-F]{1,4}|([0-9a-fA-F]{1,4}:){1,7}:|([0-9a-fA-F]{1,4}:){1,6}:[0-9a-fA-F]{1,4}|([0-9a-fA-F]{1,4}:){1,5}(:[0-9a-fA-F]{1,4}){1,2}|([0-9a-fA-F]{1,4}:){1,4}(:[0-9a-fA-F]{1,4}){1,3}|([0-9a-fA-F]{1,4}:){1,3}(:[0-9a-fA-F]{1,4}){1,4}|([0-9a-fA-F]{1,4}:){1,2}(:[0-9a-fA-F]{1,4}){1,5}|[0-9a-fA-F]{1,4}:((:[0-9a-fA-F]{1,4}){1,6})|:((:[0-9a-fA-F]{1,4}){1,7}|:)|fe80::(fe80(:[0-9a-fA-F]{0,4})?){0,4}%[0-9a-zA-Z]+|::(ffff(:0{1,4})?:)?((25[0-5]|(2[0-4]|1?\\d)?\\d)\\.){3}(25[0-5]|(2[0-4]|1?\\d)?\\d)|([0-9a-fA-F]{1,4}:){1,4}:((25[0-5]|(2[0-4]|1?\\d)?\\d)\\.){3}(25[0-5]|(2[0-4]|1?\\d)?\\d))$"
         private val IPV6_PATTERN: Pattern = Pattern.compile(IPV6_REGEX)
+        private const val CORE_STATS_INTERVAL_MS = 1000L
+        private const val BENCHMARK_FILE_NAME = "benchmark_result.json"
 
         @Suppress("DEPRECATION")
         fun isServiceRunning(context: Context, serviceClass: Class<*>): Boolean {
@@ -13,7 +13,12 @@ data class SwitchStates(
     val useTemplateEnabled: Boolean,
     val httpProxyEnabled: Boolean,
     val bypassLanEnabled: Boolean,
+    val socksPipelineEnabled: Boolean,
+    val udpInTcpEnabled: Boolean,
+    val mapDnsEnabled: Boolean,
     val disableVpn: Boolean,
+    val autoSelectConfig: Boolean,
+    val serviceTracing: Boolean,
     val themeMode: ThemeMode
 )
 
@@ -39,5 +44,12 @@ data class SettingsState(
     val info: InfoStates,
     val files: FileStates,
     val connectivityTestTarget: InputFieldState,
-    val connectivityTestTimeout: InputFieldState
+    val connectivityTestTimeout: InputFieldState,
+    val tunnelMtu: InputFieldState,
+    val udpRecvBufferSize: InputFieldState,
+    val udpCopyBufferNums: InputFieldState,
+    val tcpBufferSize: InputFieldState,
+    val tcpIdleTimeout: InputFieldState,
+    val udpIdleTimeout: InputFieldState,
+    val mapDnsCacheSize: InputFieldState
 ) 
\ No newline at end of file